@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <new>
+#include <string_view>
+#include "allocations.h"
+
+/* Counts are kept in fixed arrays rather than containers, since updating a container
+ * would allocate inside operator new */
+static const int maxPhases = 32;
+static const char *phaseNames[maxPhases] = {"(before first phase)"};
+static std::atomic<size_t> allocationCounts[maxPhases];
+static std::atomic<size_t> allocationBytes[maxPhases];
+static int phaseCount = 1;
+static std::atomic<int> currentPhase = 0;
+static std::atomic<bool> tracking = false;
+
+void *operator new(size_t size) {
+    if (tracking.load(std::memory_order_relaxed)) {
+        int phase = currentPhase.load(std::memory_order_relaxed);
+        allocationCounts[phase].fetch_add(1, std::memory_order_relaxed);
+        allocationBytes[phase].fetch_add(size, std::memory_order_relaxed);
+    }
+    void *block = malloc((size > 0) ? size : 1);
+    if (block == NULL)
+        throw std::bad_alloc();
+    return block;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *block) noexcept {
+    free(block);
+}
+
+void operator delete[](void *block) noexcept {
+    free(block);
+}
+
+void operator delete(void *block, size_t) noexcept {
+    free(block);
+}
+
+void operator delete[](void *block, size_t) noexcept {
+    free(block);
+}
+
+void trackAllocations() {
+    for (int phase = 0; phase < maxPhases; phase++) {
+        allocationCounts[phase] = 0;
+        allocationBytes[phase] = 0;
+    }
+    phaseCount = 1;
+    currentPhase = 0;
+    tracking = true;
+}
+
+// Phases are looked up by name, so a phase entered again adds to its earlier counts
+void allocationPhase(const char *name) {
+    if (!tracking)
+        return;
+    int phase = 0;
+    while ((phase < phaseCount) && (std::string_view(phaseNames[phase]) != name))
+        phase++;
+    if (phase == phaseCount) {
+        if (phaseCount == maxPhases)
+            phase = 0;
+        else
+            phaseNames[phaseCount++] = name;
+    }
+    currentPhase = phase;
+}
+
+void reportAllocations(size_t grammarSize) {
+    if (!tracking)
+        return;
+    tracking = false;
+
+    size_t totalCount = 0, totalBytes = 0;
+    int order[maxPhases];
+    for (int phase = 0; phase < phaseCount; phase++) {
+        totalCount += allocationCounts[phase];
+        totalBytes += allocationBytes[phase];
+        order[phase] = phase;
+    }
+    std::sort(order, order + phaseCount, [](int a, int b) {return allocationBytes[a] > allocationBytes[b];});
+
+    std::cout << "\nAllocations\n";
+    std::cout << std::format("total: {} allocations, {} bytes", totalCount, totalBytes);
+    if (grammarSize > 0)
+        std::cout << std::format(", {:.1f} allocations per grammar byte", (double)totalCount / grammarSize);
+    std::cout << "\n";
+    for (int i = 0; i < phaseCount; i++) {
+        int phase = order[i];
+        if (allocationCounts[phase] == 0)
+            continue;
+        std::cout << std::format("{}: {} allocations, {} bytes ({:.1f}% of bytes), {:.1f} bytes per allocation\n",
+            phaseNames[phase], allocationCounts[phase].load(), allocationBytes[phase].load(),
+            100.0 * allocationBytes[phase] / totalBytes, (double)allocationBytes[phase] / allocationCounts[phase]);
+    }
+}
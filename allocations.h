@@ -0,0 +1,12 @@
+#pragma once
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+/* Allocation tracking for the generator: global operator new and delete are replaced, and
+ * while tracking is on, each allocation (from any thread) is counted against the current
+ * phase */
+void trackAllocations();                    // clear counts and start tracking
+void allocationPhase(const char *name);     // count later allocations against phase (name must outlive tracking)
+void reportAllocations(size_t grammarSize); // stop tracking, and print phases that allocated most
+
+#endif
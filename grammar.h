@@ -17,6 +17,14 @@ enum SYMBOL_TYPE {
     DISJ,     // '|' (disjunction)
     CONJ,     // '&' (conjunction)
     NEG,      // '~' (negation)
+    LPAREN,   // '(' (start of group)
+    RPAREN,   // ')' (end of group)
+    STAR,     // '*' (repetition)
+    PLUS,     // '+' (repetition, at least once)
+    OPT,      // '?' (option)
+    LEVEL,    // '%left', '%right', '%prefix' or '%postfix' (operator precedence level)
+    TYPE,     // '<...>' (type of non-terminal's value)
+    ACTION,   // '{...}' (semantic action)
     SC,       // semicolon
     EOF_CHAR, // end of file
     INVALID,
@@ -31,17 +39,45 @@ using StrSet = std::set<std::string>;
 using StrVec = std::vector<std::string>;
 using SymbVec = std::vector<SYMBOL>;
 
+// Kinds of operators in precedence declarations
+enum OPERATOR_TYPE {
+    LEFT_OP,    // left-associative binary operator
+    RIGHT_OP,   // right-associative binary operator
+    PREFIX_OP,  // unary prefix operator
+    POSTFIX_OP, // unary postfix operator
+};
+
+// Precedence level declared for a non-terminal: operators of one kind that bind equally
+struct OperatorLevel {
+    int type;         // kind of operators
+    StrVec operators; // terminals
+};
+
+#include "seq_set.h"
+
+using SeqSets = std::map<std::string, SeqSet>; // set of sequences for each non-terminal
+
 // Grammar AST node
 class GrammarNode {
     public:
         virtual ~GrammarNode() {}
         virtual std::string toString(int depth) const {return "";};
         virtual StrSet references() const {return StrSet();};
-        virtual std::set<StrVec> pFirstSet(std::string nt, int k) {return std::set<StrVec>();};
-        virtual void pFollowAdd(std::string nt, int k) const {};
+        virtual std::vector<StrVec> referenceLists() const {return std::vector<StrVec>();};
+        virtual std::shared_ptr<GrammarNode> withNames(const std::map<std::string, std::string>& names) const {return nullptr;};
+        virtual SeqSet pFirstSet(std::string nt, int k) {return SeqSet();};
+        virtual SeqSet pFirstDelta(std::string nt, int k, const SeqSets& deltas) {return SeqSet();};
+        virtual void pFollowAdd(std::string nt, int k, const SeqSet& ntPFollows, SeqSets& partialPFollows) const {};
         virtual bool isPositive() const {return true;};
-        virtual void updateTable(std::string nt, int k) {};
+        virtual void numberRules(std::string nt) {};
         virtual SymbVec getSymbols() const {return SymbVec();};
+        virtual std::string getAction() const {return "";};
+        virtual SeqSet getPFirsts() const {return SeqSet();};
+        virtual void setPFirsts(SeqSet pFirsts) {};
+        virtual std::vector<std::shared_ptr<GrammarNode>> getChildren() const {return {};};
+        virtual void addContexts(std::string nt, std::map<std::string, StrSet>& contexts) const {};
+        virtual void addRefContexts(std::string nt, const std::map<std::string, std::string>& blocks, std::map<std::string, StrSet>& contexts) const {};
+        virtual std::shared_ptr<GrammarNode> withClasses() const {return nullptr;};
 };
 
 using GNode = std::shared_ptr<GrammarNode>;
@@ -50,30 +86,46 @@ using GNodeList = std::vector<GNode>;
 // Conjunct (sequence of symbols)
 class Conjunct: public GrammarNode {
     SymbVec Symbols;
-    bool Pos;        // true if positive conjunct, false if negative conjunct
+    bool Pos;           // true if positive conjunct, false if negative conjunct
+    std::string Action; // semantic action code ("" if none)
 
     public:
-        Conjunct(SymbVec symbols, bool pos): Symbols(std::move(symbols)), Pos(pos) {}
+        Conjunct(SymbVec symbols, bool pos, std::string action = ""): Symbols(std::move(symbols)), Pos(pos), Action(std::move(action)) {}
         std::string toString(int depth) const override;
         StrSet references() const override;
-        std::set<StrVec> pFirstSet(std::string nt, int k) override;
-        void pFollowAdd(std::string nt, int k) const override;
+        std::vector<StrVec> referenceLists() const override;
+        GNode withNames(const std::map<std::string, std::string>& names) const override;
+        SeqSet pFirstSet(std::string nt, int k) override;
+        SeqSet pFirstDelta(std::string nt, int k, const SeqSets& deltas) override;
+        void pFollowAdd(std::string nt, int k, const SeqSet& ntPFollows, SeqSets& partialPFollows) const override;
         bool isPositive() const override {return Pos;};
         SymbVec getSymbols() const override {return Symbols;};
+        std::string getAction() const override {return Action;};
+        GNode withClasses() const override;
 };
 
 // Rule (intersection of conjuncts)
 class Rule: public GrammarNode {
     GNodeList ConjList;
-    std::set<StrVec> PFirsts; // PFIRST set of rule
+    SeqSet PFirsts;                  // PFIRST set of rule
+    std::vector<SeqSet> ConjPFirsts; // PFIRST set of each positive conjunct
 
     public:
         Rule(GNodeList conjList): ConjList(std::move(conjList)) {}
         std::string toString(int depth) const override;
         StrSet references() const override;
-        std::set<StrVec> pFirstSet(std::string nt, int k) override;
-        void pFollowAdd(std::string nt, int k) const override;
-        void updateTable(std::string nt, int k) override;
+        std::vector<StrVec> referenceLists() const override;
+        GNode withNames(const std::map<std::string, std::string>& names) const override;
+        SeqSet pFirstSet(std::string nt, int k) override;
+        SeqSet pFirstDelta(std::string nt, int k, const SeqSets& deltas) override;
+        void pFollowAdd(std::string nt, int k, const SeqSet& ntPFollows, SeqSets& partialPFollows) const override;
+        void numberRules(std::string nt) override;
+        void addContexts(std::string nt, std::map<std::string, StrSet>& contexts) const override;
+        void addRefContexts(std::string nt, const std::map<std::string, std::string>& blocks, std::map<std::string, StrSet>& contexts) const override;
+        GNode withClasses() const override;
+        SeqSet getPFirsts() const override {return PFirsts;};
+        void setPFirsts(SeqSet pFirsts) override {PFirsts = std::move(pFirsts);};
+        GNodeList getChildren() const override {return ConjList;};
 };
 
 // Disjunction (union of rules)
@@ -84,13 +136,35 @@ class Disj: public GrammarNode {
         Disj(GNodeList ruleList): RuleList(std::move(ruleList)) {}
         std::string toString(int depth) const override;
         StrSet references() const override;
-        std::set<StrVec> pFirstSet(std::string nt, int k) override;
-        void pFollowAdd(std::string nt, int k) const override;
-        void updateTable(std::string nt, int k) override;
+        std::vector<StrVec> referenceLists() const override;
+        GNode withNames(const std::map<std::string, std::string>& names) const override;
+        SeqSet pFirstSet(std::string nt, int k) override;
+        SeqSet pFirstDelta(std::string nt, int k, const SeqSets& deltas) override;
+        void pFollowAdd(std::string nt, int k, const SeqSet& ntPFollows, SeqSets& partialPFollows) const override;
+        void numberRules(std::string nt) override;
+        void addContexts(std::string nt, std::map<std::string, StrSet>& contexts) const override;
+        void addRefContexts(std::string nt, const std::map<std::string, std::string>& blocks, std::map<std::string, StrSet>& contexts) const override;
+        GNode withClasses() const override;
+        GNodeList getChildren() const override {return RuleList;};
 };
 
 extern StrSet alphabet; // set of terminal symbols used by grammar
-extern std::map<std::pair<std::string, std::string>, int> parseTable; // parsing table
+extern StrSet ebnfNts; // non-terminals made for groups, options and repetitions
+extern std::map<std::string, std::vector<OperatorLevel>> operatorLevels; // precedence levels of each non-terminal, lowest first
+extern std::map<std::string, std::string> operatorHelpers; // non-terminal each one made for precedence levels belongs to
+extern std::map<std::string, std::string> ntTypes; // type of value of each non-terminal with semantic actions
+extern std::map<std::string, std::string> terminalClasses; // representative of each terminal's class
+extern std::map<std::string, std::string> ntAliases; // non-terminal each duplicate was merged into
+extern std::map<int, std::map<std::string, StrVec>> ruleRefNames; // names used by rule's references, by non-terminal
 extern std::map<int, GNodeList> rules; // rule numbering
+extern std::map<int, std::string> ruleNames; // name of each rule in generated code
+extern std::map<int, std::string> ruleNts; // non-terminal deriving each rule
+
+// Parsing table entries of a non-terminal, mapping sequences to rule numbers
+struct TableRows {
+    std::map<std::string, int> bySeqStr; // sequences joined into strings
+    std::map<StrVec, int> bySeq;         // sequences kept as separate terminals (used for lookahead DFAs)
+};
+const TableRows& tableRows(const std::string& nt); // entries of non-terminal, valid until another's are asked for
 
 #endif
@@ -1,4 +1,8 @@
 #include <iostream>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
 #include "grammar.h"
 #include "input_parser.h"
 
@@ -6,9 +10,21 @@
 // Input Lexer //
 //-------------//
 
-FILE *inpFile; // input file
-static int lineNo = 1;
-static int columnNo = 1;
+/* Lexer and parser state is kept per thread, so that chunks of the input file can be
+ * parsed in parallel */
+FILE *inpFile;                         // input file
+static thread_local FILE *chunkFile;   // file holding chunk being parsed
+static thread_local int lineNo = 1;
+static thread_local int columnNo = 1;
+static std::mutex errorMutex;          // held by thread that has failed
+
+// Quit on error, after printing message; if several threads fail, only one prints
+static void quitWithError(std::string message) {
+    errorMutex.lock(); // never unlocked, other failing threads wait here
+    std::cout << message << std::flush;
+    fflush(stdout);
+    _Exit(1); // other threads may still be using globals, so do not destroy them
+}
 
 // Create new token
 static SYMBOL makeToken(std::string str, int tokenType) {
@@ -24,8 +40,42 @@ static SYMBOL makeToken(std::string str, int tokenType) {
 
 // Lexer error: show incorrect sequence and its position
 static void lexError(std::string unexpected) {
-    std::cout << "Lexer error [ln " + std::to_string(lineNo) + ", col " + std::to_string(columnNo - unexpected.length()) + "]: unexpected sequence '" + unexpected + "'\n";
-    exit(1); // quit on error
+    quitWithError("Lexer error [ln " + std::to_string(lineNo) + ", col " + std::to_string(columnNo - unexpected.length()) + "]: unexpected sequence '" + unexpected + "'\n");
+}
+
+/* Read text up to the bracket that closes one just read, where brackets may be nested; in
+ * code, brackets in character and string literals are skipped */
+static std::string readBracketed(char open, char close, bool code) {
+    std::string text = "";
+    int depth = 1;
+    char quote = 0; // quote that started literal being read, if any
+    char currentChar;
+    while ((currentChar = fgetc(chunkFile)) != EOF) {
+        columnNo++;
+        if ((currentChar == '\n') || (currentChar == '\r')) {
+            lineNo++;
+            columnNo = 1;
+        }
+        if (quote != 0) {
+            if (currentChar == '\\') { // escaped character does not end literal
+                text += currentChar;
+                if ((currentChar = fgetc(chunkFile)) == EOF)
+                    break;
+                columnNo++;
+            } else if (currentChar == quote) {
+                quote = 0;
+            }
+        } else if (code && ((currentChar == '"') || (currentChar == '\''))) {
+            quote = currentChar;
+        } else if (currentChar == open) {
+            depth++;
+        } else if ((currentChar == close) && (--depth == 0)) {
+            return text;
+        }
+        text += currentChar;
+    }
+    lexError(open + text); // brackets not closed before end of file
+    return text;
 }
 
 // Lexer: read characters from file and convert into tokens
@@ -34,7 +84,7 @@ static SYMBOL getToken() {
     std::string currentStr = ""; // holds string to be tokenised
 
     // Skip whitespace
-    while (isspace(currentChar = fgetc(inpFile))) {
+    while (isspace(currentChar = fgetc(chunkFile))) {
         columnNo++;
         if ((currentChar == '\n') || (currentChar == '\r')) {
             lineNo++;
@@ -47,13 +97,13 @@ static SYMBOL getToken() {
         columnNo++; // discard opening "
 
         // Add characters to string until closing " reached
-        while ((currentChar = fgetc(inpFile)) != '"') {
+        while ((currentChar = fgetc(chunkFile)) != '"') {
             if (currentChar == '\\') { // \" escape sequence for " in string
-                if ((nextChar = fgetc(inpFile)) == '"') {
+                if ((nextChar = fgetc(chunkFile)) == '"') {
                     columnNo++;
                     currentChar = nextChar; // skip \ in currentStr
                 } else {
-                    fseek(inpFile, -1, SEEK_CUR); // don't lose next character, move back 1
+                    fseek(chunkFile, -1, SEEK_CUR); // don't lose next character, move back 1
                 }
             }
             currentStr += currentChar;
@@ -70,12 +120,12 @@ static SYMBOL getToken() {
     while (isalnum(currentChar) || (currentChar == '_')) {
         currentStr += currentChar;
         columnNo++;
-        currentChar = fgetc(inpFile);
+        currentChar = fgetc(chunkFile);
     }
 
     // If characters have been added to string, return non-terminal or epsilon token
     if (currentStr != "") {
-        fseek(inpFile, -1, SEEK_CUR); // don't lose current character, move back 1
+        fseek(chunkFile, -1, SEEK_CUR); // don't lose current character, move back 1
         if (currentStr == "EPSILON")
             return makeToken(currentStr, EPSILON);
         return makeToken(currentStr, NON_TERM);
@@ -83,7 +133,7 @@ static SYMBOL getToken() {
 
     // After -, check for > to build -> derivation symbol token
     if (currentChar == '-') {
-        if ((nextChar = fgetc(inpFile)) == '>') {
+        if ((nextChar = fgetc(chunkFile)) == '>') {
             columnNo += 2;
             return makeToken("->", DERIVE);
         } else {
@@ -92,6 +142,46 @@ static SYMBOL getToken() {
         }
     }
 
+    // After %, read name of operator precedence level
+    if (currentChar == '%') {
+        currentStr += currentChar;
+        columnNo++;
+        while (isalpha(currentChar = fgetc(chunkFile))) {
+            currentStr += currentChar;
+            columnNo++;
+        }
+        if (currentChar != EOF)
+            fseek(chunkFile, -1, SEEK_CUR); // don't lose current character, move back 1
+        if ((currentStr != "%left") && (currentStr != "%right") && (currentStr != "%prefix") && (currentStr != "%postfix"))
+            lexError(currentStr);
+        return makeToken(currentStr, LEVEL);
+    }
+
+    // Type of non-terminal's value, between angle brackets (e.g. <std::vector<int>>)
+    if (currentChar == '<') {
+        int startLine = lineNo, startColumn = columnNo;
+        columnNo++;
+        currentStr = readBracketed('<', '>', false);
+        currentStr.erase(0, currentStr.find_first_not_of(" \t"));
+        currentStr.erase(currentStr.find_last_not_of(" \t") + 1);
+        if (currentStr == "")
+            lexError("<>");
+        SYMBOL token = makeToken(currentStr, TYPE);
+        token.lineNo = startLine;
+        token.columnNo = startColumn;
+        return token;
+    }
+
+    // Semantic action, between braces
+    if (currentChar == '{') {
+        int startLine = lineNo, startColumn = columnNo;
+        columnNo++;
+        SYMBOL token = makeToken(readBracketed('{', '}', true), ACTION);
+        token.lineNo = startLine;
+        token.columnNo = startColumn;
+        return token;
+    }
+
     // Single character tokens
     columnNo++;
     switch (currentChar) {
@@ -103,6 +193,16 @@ static SYMBOL getToken() {
             return makeToken("~", NEG);
         case ';':
             return makeToken(";", SC);
+        case '(':
+            return makeToken("(", LPAREN);
+        case ')':
+            return makeToken(")", RPAREN);
+        case '*':
+            return makeToken("*", STAR);
+        case '+':
+            return makeToken("+", PLUS);
+        case '?':
+            return makeToken("?", OPT);
         case EOF:
             return makeToken("EOF", EOF_CHAR);
     }
@@ -117,12 +217,16 @@ static SYMBOL getToken() {
 // Recursive Descent Parser //
 //--------------------------//
 
-static SYMBOL currentToken; // token that parser is currently reading
+static thread_local SYMBOL currentToken; // token that parser is currently reading
 
 // Parser error: show incorrect (current) token, its position, and expected sequence
 static void parseError(std::string expected) {
-    std::cout << "Parser error [ln " + std::to_string(currentToken.lineNo) + ", col " + std::to_string(currentToken.columnNo) + "]: unexpected token '" + currentToken.str + "' (expecting " + expected + ")\n";
-    exit(1); // quit on error
+    quitWithError("Parser error [ln " + std::to_string(currentToken.lineNo) + ", col " + std::to_string(currentToken.columnNo) + "]: unexpected token '" + currentToken.str + "' (expecting " + expected + ")\n");
+}
+
+// Parser error at current token, with given message
+static void tokenError(std::string message) {
+    quitWithError("Parser error [ln " + std::to_string(currentToken.lineNo) + ", col " + std::to_string(currentToken.columnNo) + "]: " + message + "\n");
 }
 
 // Check if current token is of given type
@@ -134,33 +238,173 @@ static bool match(int tokType) {
     return false; // do not move on, current token will be checked again
 }
 
-StrSet alphabet; // set of terminal symbols
+StrSet alphabet;                          // set of terminal symbols
+static thread_local StrSet *chunkAlphabet; // terminal symbols of chunk being parsed
 
-// Parse symbol (non-terminal, literal, or epsilon)
-static SYMBOL parseSymbol() {
+/* Groups, options and repetitions are replaced by references to non-terminals made for
+ * them, named after the non-terminal being defined (e.g. List__rep1):
+ *     (a | b)  ->  G -> a | b             (a group of one sequence is used in place)
+ *     X?       ->  O -> X | EPSILON
+ *     X*       ->  R -> X R | EPSILON
+ *     X+       ->  X R, or P -> a R | b R for a group (a | b)+
+ * Only sequences of symbols can be grouped (no '&' or '~') */
+StrSet ebnfNts; // non-terminals made for groups, options and repetitions
+
+static thread_local std::string currentNt; // non-terminal whose definition is being parsed
+static thread_local int ebnfCount;         // non-terminals made for its definition so far
+static thread_local std::map<std::string, GNode> *definitionEbnf; // non-terminals made for it
+
+// Name next non-terminal made for an operator of the given kind
+static std::string ebnfName(const std::string& kind) {
+    return currentNt + "__" + kind + std::to_string(++ebnfCount);
+}
+
+// Make disjunction with one rule for each alternative sequence
+static GNode sequenceDisj(const std::vector<SymbVec>& alternatives) {
+    GNodeList ruleList;
+    for (const SymbVec& symbols : alternatives)
+        ruleList.push_back(std::make_shared<Rule>(GNodeList({std::make_shared<Conjunct>(symbols, true)})));
+    return std::make_shared<Disj>(std::move(ruleList));
+}
+
+// Add non-terminal made for an operator, with one rule for each alternative sequence
+static void addEbnfNt(const std::string& name, const std::vector<SymbVec>& alternatives) {
+    (*definitionEbnf)[name] = sequenceDisj(alternatives);
+}
+
+static std::vector<SymbVec> parseAlternatives();
+
+/* Parse symbol (non-terminal, literal, epsilon, or group), followed by an optional
+ * operator, and add the symbols it stands for to symbols */
+static void parseSymbol(SymbVec& symbols) {
     SYMBOL symb = currentToken;
-    if (symb.type == LITERAL)
-        alphabet.insert(symb.str); // if symbol is terminal, add to alphabet
-    else if ((symb.type != NON_TERM) && (symb.type != EPSILON))
-        parseError("non-terminal, literal, or epsilon");
+    std::vector<SymbVec> alternatives; // sequences symbol can stand for
+    if (match(LPAREN)) {
+        alternatives = parseAlternatives();
+        if (!match(RPAREN))
+            parseError("')'");
+    } else {
+        if (symb.type == LITERAL)
+            chunkAlphabet->insert(symb.str); // if symbol is terminal, add to alphabet
+        else if ((symb.type != NON_TERM) && (symb.type != EPSILON))
+            parseError("non-terminal, literal, epsilon, or '('");
+        currentToken = getToken();
+        alternatives = {{symb}};
+    }
 
-    currentToken = getToken();
-    return symb;
+    SYMBOL ref = symb; // reference to non-terminal made for operator or group
+    ref.type = NON_TERM;
+    SYMBOL epsilon = symb;
+    epsilon.str = "EPSILON";
+    epsilon.type = EPSILON;
+
+    bool repeat = (currentToken.type == STAR) || (currentToken.type == PLUS);
+    if (repeat) {
+        SYMBOL rep = ref;
+        rep.str = ebnfName("rep");
+        std::vector<SymbVec> repAlternatives = alternatives;
+        for (SymbVec& sequence : repAlternatives)
+            sequence.push_back(rep);
+        repAlternatives.push_back({epsilon});
+        addEbnfNt(rep.str, repAlternatives);
+
+        if (match(STAR)) {
+            symbols.push_back(rep);
+            return;
+        }
+        match(PLUS);
+        for (SymbVec& sequence : alternatives)
+            sequence.push_back(rep); // first repetition, then the rest
+    }
+
+    if (match(OPT)) {
+        ref.str = ebnfName("opt");
+        alternatives.push_back({epsilon});
+        addEbnfNt(ref.str, alternatives);
+        symbols.push_back(ref);
+    } else if (alternatives.size() == 1) {
+        symbols.insert(symbols.end(), alternatives[0].cbegin(), alternatives[0].cend());
+    } else {
+        ref.str = ebnfName(repeat ? "plus" : "grp");
+        addEbnfNt(ref.str, alternatives);
+        symbols.push_back(ref);
+    }
 }
 
-// Parse conjunct: sequence of symbols, may be negated
+// Parse alternatives of group: sequences of symbols separated by pipes
+static std::vector<SymbVec> parseAlternatives() {
+    std::vector<SymbVec> alternatives;
+    do {
+        SymbVec symbols;
+        do {
+            parseSymbol(symbols);
+        } while ((currentToken.type != DISJ) && (currentToken.type != RPAREN));
+        alternatives.push_back(symbols);
+    } while (match(DISJ));
+    return alternatives;
+}
+
+/* Semantic actions compute the value of a non-terminal with a type (e.g. Sum <long> -> ...)
+ * In an action, $$ is the value, and $n stands for the n-th symbol as written; a group,
+ * option or repetition has no value, so cannot be used
+ * $n is renumbered to the symbol's position after groups, options and repetitions are
+ * replaced (X+ becomes two symbols) */
+std::map<std::string, std::string> ntTypes;
+
+static thread_local std::string definitionType; // type of non-terminal being defined ("" if none)
+
+// Renumber $n in action, given the position of each written symbol with a value (or -1)
+static std::string renumberAction(const std::string& action, const std::vector<int>& valueNos) {
+    std::string code = "";
+    for (size_t i = 0; i < action.length(); i++) {
+        if (action.compare(i, 2, "$$") == 0) {
+            code += "$$";
+            i++;
+            continue;
+        }
+        size_t end = i + 1;
+        while ((action[i] == '$') && (end < action.length()) && isdigit(action[end]))
+            end++;
+        if (end == i + 1) {
+            code += action[i];
+            continue;
+        }
+
+        std::string ref = action.substr(i, end - i);
+        size_t n = std::stoul(ref.substr(1));
+        if ((n == 0) || (n > valueNos.size()) || (valueNos[n - 1] < 0))
+            tokenError(ref + " in action does not refer to a symbol with a value");
+        code += "$" + std::to_string(valueNos[n - 1] + 1);
+        i = end - 1;
+    }
+    return code;
+}
+
+/* Parse conjunct: sequence of symbols, may be negated, and may be followed by a semantic
+ * action (only used for the first positive conjunct of a rule) */
 static GNode parseConj() {
     bool pos = true; // assume conjunct is positive
     if (match(NEG))
         pos = false; // if starts with '~', conjunct is negative
 
-    // Add symbol to sequence until ampersand, pipe or semicolon reached
+    // Add symbol to sequence until ampersand, pipe, semicolon, level or action reached
     SymbVec symbols;
+    std::vector<int> valueNos; // position of each written symbol with a value (-1 if none)
     do {
-        SYMBOL nextSymb = parseSymbol();
-        symbols.push_back(nextSymb);
-    } while ((currentToken.type != CONJ) && (currentToken.type != DISJ) && (currentToken.type != SC));
-    return std::make_shared<Conjunct>(std::move(symbols), pos);
+        size_t symbNo = symbols.size();
+        parseSymbol(symbols);
+        bool single = (symbols.size() == symbNo + 1) && (symbols.back().type != EPSILON) && (definitionEbnf->count(symbols.back().str) == 0);
+        valueNos.push_back(single ? symbNo : -1);
+    } while ((currentToken.type != CONJ) && (currentToken.type != DISJ) && (currentToken.type != SC) && (currentToken.type != LEVEL) && (currentToken.type != ACTION));
+
+    std::string action = "";
+    if (currentToken.type == ACTION) {
+        if (definitionType == "")
+            tokenError("action in rule for non-terminal " + currentNt + ", which has no type");
+        action = renumberAction(currentToken.str, valueNos);
+        currentToken = getToken();
+    }
+    return std::make_shared<Conjunct>(std::move(symbols), pos, action);
 }
 
 // Parse rule: list of conjuncts
@@ -174,7 +418,10 @@ static GNode parseRule() {
     return std::make_shared<Rule>(std::move(conjList));
 }
 
-// Parse disjunction of rules
+static thread_local std::vector<OperatorLevel> *definitionLevels; // precedence levels of definition
+
+/* Parse disjunction of rules, followed by any operator precedence levels, lowest first
+ * (e.g. %left "+" "-"), whose operands are given by the rules */
 static GNode parseDisj() {
     GNodeList ruleList;
 
@@ -183,15 +430,48 @@ static GNode parseDisj() {
         ruleList.push_back(parseRule());
     } while (match(DISJ));
 
+    // Add level until no level follows, each with at least one operator
+    while (currentToken.type == LEVEL) {
+        if (definitionType != "")
+            tokenError("non-terminal " + currentNt + " has a type, so cannot have precedence levels");
+        OperatorLevel level;
+        std::map<std::string, int> types = {{"%left", LEFT_OP}, {"%right", RIGHT_OP}, {"%prefix", PREFIX_OP}, {"%postfix", POSTFIX_OP}};
+        level.type = types[currentToken.str];
+        currentToken = getToken();
+        do {
+            if (currentToken.type != LITERAL)
+                parseError("literal");
+            chunkAlphabet->insert(currentToken.str);
+            level.operators.push_back(currentToken.str);
+            currentToken = getToken();
+        } while (currentToken.type == LITERAL);
+        definitionLevels->push_back(level);
+    }
+
     // Disjunction must be terminated with semicolon
     if (!match(SC))
         parseError("';'");
     return std::make_shared<Disj>(std::move(ruleList));
 }
 
-// Parse grammar: map non-terminals to disjunctions of rules
-std::map<std::string, GNode> parseGrammar() {
+// Grammar parsed from one chunk of the input file
+struct Chunk {
+    const char *start;       // first character of chunk
+    size_t length;
+    int lineNo, columnNo;    // position of first character in input file
     std::map<std::string, GNode> disjList;
+    std::map<std::string, std::map<std::string, GNode>> ebnfLists; // non-terminals made for each definition
+    std::map<std::string, std::vector<OperatorLevel>> levelLists;    // precedence levels of each definition
+    std::map<std::string, std::string> types;                        // type of each definition ("" if none)
+    StrSet alphabet;
+};
+
+// Parse chunk of input: map non-terminals to disjunctions of rules
+static void parseChunk(FILE *file, Chunk& chunk) {
+    chunkFile = file;
+    lineNo = chunk.lineNo;
+    columnNo = chunk.columnNo;
+    chunkAlphabet = &chunk.alphabet;
     currentToken = getToken(); // get first token
 
     // Add disjunction until EOF reached
@@ -199,11 +479,231 @@ std::map<std::string, GNode> parseGrammar() {
         std::string nt = currentToken.str; // get key (non-terminal)
         if (!match(NON_TERM))
             parseError("non-terminal");
+        definitionType = "";
+        if (currentToken.type == TYPE) {
+            definitionType = currentToken.str;
+            currentToken = getToken();
+        }
         if (!match(DERIVE))
             parseError("'->'"); // non-terminal must be followed by derive symbol
 
-        GNode nextDisj = parseDisj();       // get value (disjunction)
-        disjList[nt] = std::move(nextDisj); // insert key & value into map
+        chunk.types[nt] = definitionType;
+        currentNt = nt;
+        ebnfCount = 0;
+        definitionEbnf = &chunk.ebnfLists[nt];
+        definitionEbnf->clear(); // non-terminal may be defined again
+        definitionLevels = &chunk.levelLists[nt];
+        definitionLevels->clear();
+        GNode nextDisj = parseDisj();             // get value (disjunction)
+        chunk.disjList[nt] = std::move(nextDisj); // insert key & value into map
     } while (!match(EOF_CHAR));
+}
+
+/* Split input into chunks of roughly equal size, for parsing in parallel
+ * Chunks end at semicolons outside string literals and semantic actions, so each chunk
+ * holds whole disjunctions; line and column numbers are counted as the lexer counts them */
+static std::vector<Chunk> splitInput(const char *input, size_t length, size_t chunkCount) {
+    std::vector<Chunk> chunks;
+    Chunk current = {input, 0, 1, 1, {}, {}, {}, {}, {}};
+    int line = 1, column = 1;
+    bool inString = false;
+    int actionDepth = 0; // depth of braces in semantic action
+    char quote = 0;      // quote that started literal in semantic action, if any
+    for (size_t i = 0; i < length; i++) {
+        char c = input[i];
+        column++;
+        if (inString) {
+            if ((c == '\\') && (i + 1 < length) && (input[i + 1] == '"')) {
+                i++; // escaped " does not end string
+                column++;
+            } else if (c == '"') {
+                inString = false;
+            }
+        } else if (actionDepth > 0) {
+            if ((c == '\n') || (c == '\r')) {
+                line++;
+                column = 1;
+            }
+            if (quote != 0) {
+                if ((c == '\\') && (i + 1 < length)) {
+                    i++; // escaped character does not end literal
+                    column++;
+                } else if (c == quote) {
+                    quote = 0;
+                }
+            } else if ((c == '"') || (c == '\'')) {
+                quote = c;
+            } else if (c == '{') {
+                actionDepth++;
+            } else if (c == '}') {
+                actionDepth--;
+            }
+        } else if (c == '{') {
+            actionDepth = 1;
+        } else if (c == '"') {
+            inString = true;
+        } else if ((c == '\n') || (c == '\r')) {
+            line++;
+            column = 1;
+        } else if ((c == ';') && (i + 1 - (current.start - input) >= length / chunkCount)) {
+            current.length = i + 1 - (current.start - input);
+            chunks.push_back(current);
+            current = {input + i + 1, 0, line, column, {}, {}, {}, {}, {}};
+        }
+    }
+    current.length = length - (current.start - input);
+
+    // Join last chunk to previous one if it holds no disjunctions (only whitespace)
+    bool empty = true;
+    for (size_t i = 0; i < current.length; i++)
+        empty = empty && isspace(current.start[i]);
+    if (empty && !chunks.empty())
+        chunks.back().length += current.length;
+    else
+        chunks.push_back(current);
+    return chunks;
+}
+
+//--------------------------------//
+// Operator Precedence Declarations //
+//--------------------------------//
+
+std::map<std::string, std::vector<OperatorLevel>> operatorLevels;
+std::map<std::string, std::string> operatorHelpers;
+
+// Make symbol for rule of non-terminal made for precedence levels
+static SYMBOL makeSymbol(std::string str, int type) {
+    SYMBOL symb;
+    symb.str = str;
+    symb.type = type;
+    symb.lineNo = 0;
+    symb.columnNo = 0;
+    return symb;
+}
+
+/* Replace definition of non-terminal E that has precedence levels with a grammar without
+ * them, which is used for analysis (the parser for E is generated from the levels):
+ *     E -> E__unit E__infix
+ *     E__infix -> E__op1 E__unit E__infix | ... | EPSILON   (one rule per binary level)
+ *     E__unit -> E__op2 E__unit | ... | E__operand E__postfix   (one rule per prefix level)
+ *     E__postfix -> E__op3 E__postfix | ... | EPSILON   (one rule per postfix level)
+ *     E__operand -> rules of E
+ *     E__opN -> operators of level N
+ * E__infix and E__postfix are left out if there are no levels of their kind
+ * An operator may only be in one binary, one prefix and one postfix level */
+static void addOperatorNts(std::map<std::string, GNode>& disjList, const std::string& nt) {
+    const std::vector<OperatorLevel>& levels = operatorLevels[nt];
+    std::map<std::string, GNode> made;
+    std::vector<SymbVec> infixRules, unitRules, postfixRules;
+    std::set<std::pair<int, std::string>> declared; // operators of binary, prefix and postfix levels
+    for (size_t i = 0; i < levels.size(); i++) {
+        std::string levelNt = nt + "__op" + std::to_string(i + 1);
+        std::vector<SymbVec> opRules;
+        for (const std::string& op : levels[i].operators) {
+            int group = (levels[i].type == RIGHT_OP) ? LEFT_OP : levels[i].type;
+            if (!declared.insert(make_pair(group, op)).second)
+                quitWithError("Parser error: operator " + op + " is declared twice for " + nt + "\n");
+            opRules.push_back({makeSymbol(op, LITERAL)});
+        }
+        made[levelNt] = sequenceDisj(opRules);
+
+        SYMBOL levelSymb = makeSymbol(levelNt, NON_TERM);
+        if (levels[i].type == PREFIX_OP)
+            unitRules.push_back({levelSymb, makeSymbol(nt + "__unit", NON_TERM)});
+        else if (levels[i].type == POSTFIX_OP)
+            postfixRules.push_back({levelSymb, makeSymbol(nt + "__postfix", NON_TERM)});
+        else
+            infixRules.push_back({levelSymb, makeSymbol(nt + "__unit", NON_TERM), makeSymbol(nt + "__infix", NON_TERM)});
+    }
+
+    SymbVec operand = {makeSymbol(nt + "__operand", NON_TERM)};
+    if (!postfixRules.empty()) {
+        operand.push_back(makeSymbol(nt + "__postfix", NON_TERM));
+        postfixRules.push_back({makeSymbol("EPSILON", EPSILON)});
+    }
+    unitRules.push_back(operand);
+    SymbVec top = {makeSymbol(nt + "__unit", NON_TERM)};
+    if (!infixRules.empty()) {
+        top.push_back(makeSymbol(nt + "__infix", NON_TERM));
+        infixRules.push_back({makeSymbol("EPSILON", EPSILON)});
+    }
+
+    made[nt + "__unit"] = sequenceDisj(unitRules);
+    if (!infixRules.empty())
+        made[nt + "__infix"] = sequenceDisj(infixRules);
+    if (!postfixRules.empty())
+        made[nt + "__postfix"] = sequenceDisj(postfixRules);
+    made[nt + "__operand"] = disjList[nt];
+    disjList[nt] = sequenceDisj({top});
+
+    for (auto& disj : made) {
+        if (disjList.count(disj.first) > 0)
+            quitWithError("Parser error: non-terminal " + disj.first + " has the name of a non-terminal made for the operators of " + nt + "\n");
+        operatorHelpers[disj.first] = nt;
+        disjList[disj.first] = std::move(disj.second);
+    }
+}
+
+static const size_t minParallelSize = 1 << 16; // smaller files are parsed in one chunk
+
+/* Parse grammar: map non-terminals to disjunctions of rules
+ * Large files are memory-mapped, split into chunks and parsed in parallel; the results
+ * are merged in file order, so a non-terminal defined twice keeps its last definition
+ * (and the non-terminals made for it) */
+std::map<std::string, GNode> parseGrammar() {
+    struct stat fileStat;
+    char *input = (char *) MAP_FAILED;
+    size_t length = 0;
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    if ((threadCount > 1) && (fstat(fileno(inpFile), &fileStat) == 0) && ((size_t)fileStat.st_size >= minParallelSize)) {
+        length = fileStat.st_size;
+        input = (char *) mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(inpFile), 0);
+    }
+
+    std::vector<Chunk> chunks;
+    if (input == MAP_FAILED) {
+        chunks.push_back({NULL, 0, 1, 1, {}, {}, {}, {}, {}});
+        parseChunk(inpFile, chunks[0]);
+    } else {
+        chunks = splitInput(input, length, threadCount);
+        std::vector<std::thread> threads;
+        for (Chunk& chunk : chunks) {
+            threads.emplace_back([&chunk]() {
+                FILE *file = fmemopen((void *) chunk.start, chunk.length, "r");
+                parseChunk(file, chunk);
+                fclose(file);
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+        munmap(input, length);
+    }
+
+    std::map<std::string, GNode> disjList;
+    std::map<std::string, std::map<std::string, GNode>> ebnfLists;
+    for (Chunk& chunk : chunks) {
+        for (auto& disj : chunk.disjList)
+            disjList[disj.first] = std::move(disj.second);
+        for (auto& ebnfList : chunk.ebnfLists)
+            ebnfLists[ebnfList.first] = std::move(ebnfList.second);
+        for (auto& levelList : chunk.levelLists)
+            operatorLevels[levelList.first] = std::move(levelList.second);
+        for (const auto& type : chunk.types)
+            ntTypes[type.first] = type.second;
+        alphabet.insert(chunk.alphabet.cbegin(), chunk.alphabet.cend());
+    }
+    std::erase_if(operatorLevels, [](const auto& levelList) {return (levelList.second).empty();});
+    std::erase_if(ntTypes, [](const auto& type) {return type.second == "";});
+
+    for (auto& ebnfList : ebnfLists) {
+        for (auto& disj : ebnfList.second) {
+            if (disjList.count(disj.first) > 0)
+                quitWithError("Parser error: non-terminal " + disj.first + " has the name of a group in the definition of " + ebnfList.first + "\n");
+            ebnfNts.insert(disj.first);
+            disjList[disj.first] = std::move(disj.second);
+        }
+    }
+    for (const auto& levelList : operatorLevels)
+        addOperatorNts(disjList, levelList.first);
     return disjList;
 }
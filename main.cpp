@@ -1,9 +1,17 @@
 #include <algorithm>
 #include <iostream>
+#include <optional>
+#include <sstream>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <thread>
+#include "allocations.h"
 #include "grammar.h"
 #include "input_parser.h"
+#include "perf_counters.h"
 #include "rd_codegen.h"
+#include "regular.h"
+#include "server.h"
 
 //---------------------//
 // Grammar AST Printer //
@@ -27,16 +35,18 @@ std::string printStrs(StrVec strs) {
     return result;
 }
 
-// Print elements of set of vectors of strings
-std::string printStrs(std::set<StrVec> fSet) {
-    std::string result = "";
-    for (StrVec v : fSet) {
-        for (std::string s : v)
-            result = (s == "") ? result + " EPSILON" : result + " " + s;
-        result += ",";
-    }
-    result.pop_back();
-    return result;
+/* Print elements of set of vectors of strings, separated by commas
+ * Sequences are written to the stream as they are read, since a set kept on disk may not
+ * fit in memory */
+void printSeqs(std::ostream& out, const SeqSet& fSet) {
+    bool first = true;
+    fSet.forEach([&](const StrVec& v) {
+        if (!first)
+            out << ",";
+        first = false;
+        for (const std::string& s : v)
+            out << ((s == "") ? " EPSILON" : " " + s);
+    });
 }
 
 // Make indentation of given width
@@ -83,6 +93,8 @@ std::string Conjunct::toString(int depth) const {
     result += " CONJUNCT:\n";
     for (const SYMBOL& symb : Symbols)
         result += printSymb(symb, depth + 1);
+    if (Action != "")
+        result += makeIndent(depth + 1) + "ACTION: {" + Action + "}\n";
     return result;
 }
 
@@ -96,6 +108,310 @@ std::string Disj::toString(int depth) const {
     return makeIndent(depth) + nlString(RuleList, depth + 1);
 }
 
+//------------------------------//
+// Terminal Equivalence Classes //
+//------------------------------//
+
+// Representative of each terminal's class (first terminal of class in alphabetical order)
+std::map<std::string, std::string> terminalClasses;
+
+/* Add contexts of terminals in rule to each terminal's set of contexts
+ * A context is the rule written out with one occurrence of the terminal replaced by a
+ * hole, prefixed by the non-terminal deriving the rule */
+void Rule::addContexts(std::string nt, std::map<std::string, StrSet>& contexts) const {
+    StrVec items; // one item per conjunct sign and symbol, unambiguous when joined
+    std::vector<size_t> literalNos;
+    for (const GNode& conj : ConjList) {
+        items.push_back(conj->isPositive() ? "+" : "-");
+        if (conj->getAction() != "")
+            items.push_back("{" + std::to_string(conj->getAction().length()) + ":" + conj->getAction()); // rules with different actions are not copies
+        for (const SYMBOL& symb : conj->getSymbols()) {
+            if (symb.type == LITERAL)
+                literalNos.push_back(items.size());
+            items.push_back(std::to_string(symb.type) + ":" + std::to_string(symb.str.length()) + ":" + symb.str);
+        }
+    }
+
+    for (size_t literalNo : literalNos) {
+        std::string context = nt + " ";
+        for (size_t i = 0; i < items.size(); i++)
+            context += (i == literalNo) ? "?" : items[i];
+
+        std::string term = items[literalNo].substr(items[literalNo].find(':', 2) + 1);
+        contexts[term].insert(context);
+    }
+}
+
+// Add contexts of terminals in each rule of disjunction
+void Disj::addContexts(std::string nt, std::map<std::string, StrSet>& contexts) const {
+    for (const GNode& rule : RuleList)
+        rule->addContexts(nt, contexts);
+}
+
+// Copy conjunct, replacing each terminal with representative of its class
+GNode Conjunct::withClasses() const {
+    SymbVec symbols = Symbols;
+    for (SYMBOL& symb : symbols) {
+        if (symb.type == LITERAL)
+            symb.str = terminalClasses[symb.str];
+    }
+    return std::make_shared<Conjunct>(symbols, Pos, Action);
+}
+
+// Copy rule, replacing each terminal with representative of its class
+GNode Rule::withClasses() const {
+    GNodeList conjList;
+    for (const GNode& conj : ConjList)
+        conjList.push_back(conj->withClasses());
+    return std::make_shared<Rule>(conjList);
+}
+
+/* Copy disjunction, replacing each terminal with representative of its class
+ * Rules that only differ by terminals in the same class become identical, so only the
+ * first is kept */
+GNode Disj::withClasses() const {
+    GNodeList ruleList;
+    StrSet ruleStrs;
+    for (const GNode& rule : RuleList) {
+        GNode classRule = rule->withClasses();
+        if (ruleStrs.insert(classRule->toString(0)).second)
+            ruleList.push_back(classRule);
+    }
+    return std::make_shared<Disj>(ruleList);
+}
+
+/* Partition terminals into classes of interchangeable terminals, and return grammar over
+ * class representatives
+ * Terminals are in the same class if they occur in exactly the same contexts: every rule
+ * using one has a copy using the other in its place, so the language is unchanged when
+ * either is substituted for the other, and no lookahead decision can tell them apart
+ * (e.g. digits, or keywords that start the same kind of statement)
+ * PFIRST/PFOLLOW sets and the parsing table are then computed over classes, and each
+ * group of rules that only differ by terminals in the same class becomes a single rule */
+std::map<std::string, GNode> mergeTerminalClasses(const std::map<std::string, GNode>& grammar) {
+    std::map<std::string, StrSet> contexts;
+    for (const auto& disj : grammar)
+        disj.second->addContexts(disj.first, contexts);
+
+    std::map<StrSet, std::string> classReps;
+    for (const std::string& term : alphabet)
+        terminalClasses[term] = classReps.emplace(contexts[term], term).first->second;
+
+    std::map<std::string, GNode> classGrammar;
+    for (const auto& disj : grammar)
+        classGrammar[disj.first] = disj.second->withClasses();
+    return classGrammar;
+}
+
+//-------------------------//
+// Duplicate Non-Terminals //
+//-------------------------//
+
+// Non-terminal that each duplicate non-terminal has been merged into
+std::map<std::string, std::string> ntAliases;
+
+/* Names of non-terminals referenced by each rule (key), in order, as written in the
+ * definition of each non-terminal (key) that uses the rule */
+std::map<int, std::map<std::string, StrVec>> ruleRefNames;
+
+// Get list of non-terminals used in conjunct, in order
+std::vector<StrVec> Conjunct::referenceLists() const {
+    StrVec ntsReferenced;
+    for (const SYMBOL& symb : Symbols) {
+        if (symb.type == NON_TERM)
+            ntsReferenced.push_back(symb.str);
+    }
+    return {ntsReferenced};
+}
+
+// Get list of non-terminals used in rule, in order (conjuncts' lists joined)
+std::vector<StrVec> Rule::referenceLists() const {
+    StrVec ntsReferenced;
+    for (const GNode& conj : ConjList) {
+        StrVec conjReferences = conj->referenceLists()[0];
+        ntsReferenced.insert(ntsReferenced.end(), conjReferences.cbegin(), conjReferences.cend());
+    }
+    return {ntsReferenced};
+}
+
+// Get list of non-terminals used in each rule of disjunction
+std::vector<StrVec> Disj::referenceLists() const {
+    std::vector<StrVec> ruleReferences;
+    for (const GNode& rule : RuleList)
+        ruleReferences.push_back(rule->referenceLists()[0]);
+    return ruleReferences;
+}
+
+/* Add contexts of non-terminals referenced by rule to each one's set of contexts
+ * A reference's PFOLLOW sequences only depend on the symbols after it in its conjunct and
+ * on the PFOLLOW set of the deriving non-terminal, so its context is those symbols, with
+ * non-terminals replaced by their blocks, prefixed by the deriving non-terminal's block
+ * A reference to another non-terminal in the deriving one's block would become a reference
+ * to itself when they are merged, which passes on sequences differently, so its context
+ * is prefixed by the deriving non-terminal's own name instead */
+void Rule::addRefContexts(std::string nt, const std::map<std::string, std::string>& blocks, std::map<std::string, StrSet>& contexts) const {
+    for (const GNode& conj : ConjList) {
+        SymbVec symbols = conj->getSymbols();
+        for (size_t i = 0; i < symbols.size(); i++) {
+            if (symbols[i].type != NON_TERM)
+                continue;
+
+            const std::string& ref = symbols[i].str;
+            bool sameBlock = (ref != nt) && (blocks.at(ref) == blocks.at(nt));
+            std::string context = (sameBlock ? nt : blocks.at(nt)) + " " + (conj->isPositive() ? "+" : "-");
+            for (size_t j = i + 1; j < symbols.size(); j++) {
+                std::string str = (symbols[j].type == NON_TERM) ? blocks.at(symbols[j].str) : symbols[j].str;
+                context += std::to_string(symbols[j].type) + ":" + std::to_string(str.length()) + ":" + str;
+            }
+            contexts[ref].insert(context);
+        }
+    }
+}
+
+// Add contexts of non-terminals referenced by each rule of disjunction
+void Disj::addRefContexts(std::string nt, const std::map<std::string, std::string>& blocks, std::map<std::string, StrSet>& contexts) const {
+    for (const GNode& rule : RuleList)
+        rule->addRefContexts(nt, blocks, contexts);
+}
+
+// Copy conjunct, renaming non-terminals that have a new name in names
+GNode Conjunct::withNames(const std::map<std::string, std::string>& names) const {
+    SymbVec symbols = Symbols;
+    for (SYMBOL& symb : symbols) {
+        if ((symb.type == NON_TERM) && (names.count(symb.str) > 0))
+            symb.str = names.at(symb.str);
+    }
+    return std::make_shared<Conjunct>(symbols, Pos, Action);
+}
+
+// Copy rule, renaming non-terminals that have a new name in names
+GNode Rule::withNames(const std::map<std::string, std::string>& names) const {
+    GNodeList conjList;
+    for (const GNode& conj : ConjList)
+        conjList.push_back(conj->withNames(names));
+    return std::make_shared<Rule>(conjList);
+}
+
+// Copy disjunction, renaming non-terminals that have a new name in names
+GNode Disj::withNames(const std::map<std::string, std::string>& names) const {
+    GNodeList ruleList;
+    for (const GNode& rule : RuleList)
+        ruleList.push_back(rule->withNames(names));
+    return std::make_shared<Disj>(ruleList);
+}
+
+/* Partition non-terminals into blocks of non-terminals whose definitions are identical up
+ * to renaming of non-terminals, and which are used in the same contexts
+ * Partition refinement: non-terminals start in one block, and are split by their
+ * definitions and by the contexts of their references, with each reference replaced by
+ * the block of the non-terminal it refers to, until no block is split; non-terminals in a
+ * block then have the same PFIRST sets and the same PFOLLOW sets
+ * The start symbol, non-terminals made for EBNF operators (which are parsed by loops in
+ * place), and non-terminals with precedence levels and those made for them (which are
+ * parsed together), non-terminals with types (whose values are computed by their own
+ * actions), and those in kept are always kept in blocks of their own */
+std::map<std::string, std::string> duplicateBlocks(const std::map<std::string, GNode>& grammar, const std::string& startSymbol, const StrSet& kept) {
+    /* Each definition is written out once with its references unnamed, and then only the
+     * blocks of its references (in order) are added to it on each pass */
+    std::map<std::string, std::string> blocks, unnamed; // block of each non-terminal, and empty names
+    for (const auto& disj : grammar)
+        unnamed[disj.first] = "";
+    std::map<std::string, std::string> shapes;
+    std::map<std::string, StrVec> refs;
+    for (const auto& disj : grammar) {
+        blocks[disj.first] = "";
+        shapes[disj.first] = disj.second->withNames(unnamed)->toString(0);
+        for (const StrVec& ruleRefs : disj.second->referenceLists())
+            refs[disj.first].insert(refs[disj.first].end(), ruleRefs.cbegin(), ruleRefs.cend());
+    }
+
+    /* Blocks are split by definitions alone until none is split, and then by contexts as
+     * well, so that a reference is only taken to be in the deriving non-terminal's block if
+     * their definitions are identical */
+    size_t blockCount = 1;
+    bool byContexts = false;
+    while (true) {
+        std::map<std::string, StrSet> contexts;
+        if (byContexts) {
+            for (const auto& disj : grammar)
+                disj.second->addRefContexts(disj.first, blocks, contexts);
+        }
+
+        std::map<std::string, std::string> newBlocks;
+        std::map<std::string, size_t> blockNos; // number of each block, by definition and contexts
+        for (const auto& disj : grammar) {
+            std::string definition = blocks[disj.first] + "\n" + shapes[disj.first];
+            for (const std::string& ref : refs[disj.first])
+                definition += " " + blocks[ref];
+            for (const std::string& context : contexts[disj.first])
+                definition += "\n" + context;
+            if ((disj.first == startSymbol) || (ebnfNts.count(disj.first) > 0) || (operatorLevels.count(disj.first) > 0) || (operatorHelpers.count(disj.first) > 0) || (ntTypes.count(disj.first) > 0) || (kept.count(disj.first) > 0))
+                definition = disj.first + "\n" + definition;
+            newBlocks[disj.first] = "#" + std::to_string(blockNos.emplace(definition, blockNos.size()).first->second);
+        }
+        blocks = newBlocks;
+
+        if ((blockNos.size() == blockCount) && byContexts)
+            break; // no block was split
+        byContexts = byContexts || (blockNos.size() == blockCount);
+        blockCount = blockNos.size();
+    }
+    return blocks;
+}
+
+/* Whether the names referenced by one definition can be renamed to those referenced by
+ * another in the same places, by renaming each name to a single name */
+bool renamesConsistently(const GNode& from, const GNode& to) {
+    std::vector<StrVec> fromLists = from->referenceLists(), toLists = to->referenceLists();
+    std::map<std::string, std::string> renaming;
+    for (size_t i = 0; i < fromLists.size(); i++) {
+        for (size_t j = 0; j < fromLists[i].size(); j++) {
+            if (renaming.emplace(fromLists[i][j], toLists[i][j]).first->second != toLists[i][j])
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Find duplicate non-terminals, and merge each block into its first non-terminal in
+ * topological order (ntOrder), so that ntOrder without the merged non-terminals is still a
+ * topological order
+ * A merged node found in the parser's memo under another name is relabelled by renaming
+ * the names its children were parsed under, so a non-terminal is kept apart (and blocks
+ * found again) if the names in its definition and in the first one's cannot be renamed
+ * into each other one to one
+ * Returns grammar without the merged non-terminals, with references to them renamed */
+std::map<std::string, GNode> mergeDuplicateNts(const std::map<std::string, GNode>& grammar, const StrVec& ntOrder) {
+    StrSet kept;
+    std::map<std::string, std::string> names;
+    ntAliases.clear();
+    while (true) {
+        std::map<std::string, std::string> blocks = duplicateBlocks(grammar, ntOrder.back(), kept);
+
+        // Merge each non-terminal into first non-terminal of its block
+        std::map<std::string, std::string> blockNts;
+        size_t keptCount = kept.size();
+        for (const std::string& nt : ntOrder) {
+            names[nt] = blockNts.emplace(blocks[nt], nt).first->second;
+            if ((names[nt] != nt) && (!renamesConsistently(grammar.at(nt), grammar.at(names[nt])) || !renamesConsistently(grammar.at(names[nt]), grammar.at(nt))))
+                kept.insert(nt);
+        }
+        if (kept.size() == keptCount)
+            break;
+    }
+
+    for (const std::string& nt : ntOrder) {
+        if (names[nt] != nt)
+            ntAliases[nt] = names[nt];
+    }
+    std::map<std::string, GNode> mergedGrammar;
+    for (const auto& disj : grammar) {
+        if (ntAliases.count(disj.first) == 0)
+            mergedGrammar[disj.first] = disj.second->withNames(names);
+    }
+    return mergedGrammar;
+}
+
 //-------------------------------------------------------//
 // Sort Non-Terminals for PFIRST/PFOLLOW Set Computation //
 //-------------------------------------------------------//
@@ -156,48 +472,53 @@ StrVec topologicalSort(std::map<std::string, StrSet> ntRefs) {
     return ntOrder; // return topological ordering
 }
 
-/* Concatenate each sequence in set "seqs" with each sequence in set "addSeqs"
- * Truncate each resulting sequence to k symbols, and add it to new set
- * Return this new set */
-std::set<StrVec> allConcat(std::set<StrVec> seqs, std::set<StrVec> addSeqs, int k) {
-    if (seqs.empty())
-        return addSeqs;
-
-    std::set<StrVec> newSeqs;
-    for (StrVec v : seqs) {
-        for (StrVec vec : addSeqs) {
-            StrVec newV = v;
-            newV.erase(std::remove(newV.begin(), newV.end(), ""), newV.end());
-            int i = 0;
-            while ((newV.size() < k) && (i < vec.size())) {
-                if (vec[i] != "")
-                    newV.push_back(vec[i]);
-                i++;
-            }
-            if (newV.empty())
-                newV.push_back("");
-            newSeqs.insert(newV);
+/* Check if a non-terminal refers to another that comes after it in the ordering, which
+ * only happens by indirect recursion */
+bool refersForward(const StrVec& ntOrder, std::map<std::string, StrSet>& ntRefs) {
+    std::map<std::string, size_t> orderNos;
+    for (size_t i = 0; i < ntOrder.size(); i++)
+        orderNos[ntOrder[i]] = i;
+    for (const std::string& s : ntOrder) {
+        for (const std::string& ref : ntRefs[s]) {
+            if ((orderNos.count(ref) > 0) && (orderNos[ref] > orderNos[s]))
+                return true;
         }
     }
+    return false;
+}
 
-    return newSeqs;
+/* Expand set of sequences for a self-recursive non-terminal, up to k rounds
+ * Each round only concatenates sequences added in the previous round (delta) with the
+ * current set, since all other pairs have already been concatenated
+ * Stop as soon as a round adds no new sequence */
+SeqSet selfConcat(SeqSet seqs, int k) {
+    SeqSet delta = seqs;
+    for (int i = 0; (i < k) && !delta.empty(); i++) {
+        SeqSet newSeqs = allConcat(seqs, delta, k);
+        newSeqs.insert(allConcat(delta, seqs, k));
+
+        // Keep only sequences not already in set
+        delta = setDifference(newSeqs, seqs);
+        seqs.insert(delta);
+    }
+    return seqs;
 }
 
 // PFIRST/PFOLLOW set of each non-terminal (key) is a set of sequences of terminals (value)
-std::map<std::string, std::set<StrVec>> pFirstSets, pFollowSets;
+SeqSets pFirstSets, pFollowSets;
 
 //---------------------//
 // Compute PFIRST Sets //
 //---------------------//
 
 // Compute PFIRST set of conjunct
-std::set<StrVec> Conjunct::pFirstSet(std::string nt, int k) {
+SeqSet Conjunct::pFirstSet(std::string nt, int k) {
     if ((Symbols[0].type == NON_TERM) && (Symbols[0].str == nt)) {
         std::cout << "Error: grammar contains left recursion in rule for non-terminal " + nt + "\n";
         exit(1); // quit if grammar is left-recursive
     }
 
-    std::set<StrVec> pFirsts = std::set<StrVec>(); // conjunct PFIRST set
+    SeqSet pFirsts = SeqSet(); // conjunct PFIRST set
     if (!Pos)
         return pFirsts; // if conjunct is negative, return empty set
 
@@ -207,28 +528,23 @@ std::set<StrVec> Conjunct::pFirstSet(std::string nt, int k) {
             nullable = false; // terminal is non-nullable, so conjunct is non-nullable
 
             // Append terminal to each sequence in conjunct PFIRST set with length < k
-            std::set<StrVec> symbSeq;
+            SeqSet symbSeq;
             symbSeq.insert({symb.str});
             pFirsts = allConcat(pFirsts, symbSeq, k);
 
         } else if (symb.type == NON_TERM) {
-            // If symb is the deriving non-terminal, recursively expand set k times
-            if (symb.str == nt) {
-                for (int i = 0; i < k; i++) {
-                    std::set<StrVec> pFirstsPlusE = pFirsts;
-                    pFirstsPlusE.insert({""});
-                    pFirsts = allConcat(pFirstsPlusE, pFirsts, k);
-                }
-            } else {
-                if (!pFirstSets[symb.str].contains({""}))
-                    nullable = false; // if non-terminal is non-nullable, so is conjunct
-
-                /* Concatenate each sequence in conjunct PFIRST set with each sequence in
-                 * non-terminal's PFIRST set
-                 * Add sequence consisting of first k symbols of result to a new set
-                 * Replace conjunct PFIRST set with this new set */
-                pFirsts = allConcat(pFirsts, pFirstSets[symb.str], k);
-            }
+            /* The set of a non-terminal not computed yet (including the deriving one, by
+             * recursion) has no sequences, so neither does the conjunct */
+            if (pFirstSets[symb.str].empty())
+                return SeqSet();
+            if (!pFirstSets[symb.str].contains({""}))
+                nullable = false; // if non-terminal is non-nullable, so is conjunct
+
+            /* Concatenate each sequence in conjunct PFIRST set with each sequence in
+             * non-terminal's PFIRST set
+             * Add sequence consisting of first k symbols of result to a new set
+             * Replace conjunct PFIRST set with this new set */
+            pFirsts = allConcat(pFirsts, pFirstSets[symb.str], k);
         }
     }
 
@@ -238,27 +554,61 @@ std::set<StrVec> Conjunct::pFirstSet(std::string nt, int k) {
     return pFirsts;
 }
 
+/* Compute sequences that the sequences added to non-terminals' PFIRST sets (deltas) add to
+ * PFIRST set of conjunct: for each use of a non-terminal with added sequences, those are
+ * concatenated with the full sets of the symbols before and after it, so pairs of sequences
+ * already concatenated are not concatenated again (semi-naive evaluation) */
+SeqSet Conjunct::pFirstDelta(std::string nt, int k, const SeqSets& deltas) {
+    SeqSet added;
+    if (!Pos)
+        return added;
+    for (const SYMBOL& symb : Symbols) {
+        if ((symb.type == NON_TERM) && pFirstSets[symb.str].empty())
+            return added; // conjunct has no sequences yet
+    }
+
+    for (size_t useNo = 0; useNo < Symbols.size(); useNo++) {
+        auto delta = (Symbols[useNo].type == NON_TERM) ? deltas.find(Symbols[useNo].str) : deltas.end();
+        if ((delta == deltas.end()) || delta->second.empty())
+            continue;
+
+        SeqSet pFirsts;
+        for (size_t symbNo = 0; symbNo < Symbols.size(); symbNo++) {
+            const SYMBOL& symb = Symbols[symbNo];
+            if (symb.type == LITERAL) {
+                SeqSet symbSeq;
+                symbSeq.insert({symb.str});
+                pFirsts = allConcat(pFirsts, symbSeq, k);
+            } else if (symb.type == NON_TERM) {
+                pFirsts = allConcat(pFirsts, (symbNo == useNo) ? delta->second : pFirstSets[symb.str], k);
+            }
+        }
+        added.insert(pFirsts);
+    }
+    return added;
+}
+
 // All elements of Σ* that are k or fewer terminals long; may not need to be computed
-std::set<StrVec> allFirsts = std::set<StrVec>();
+SeqSet allFirsts = SeqSet();
+
+// Non-terminals with a rule whose positive conjuncts are contradictory, in the last pass
+StrVec contradictoryNts;
 
 // Compute PFIRST set of rule (intersection of conjuncts' PFIRST sets)
-std::set<StrVec> Rule::pFirstSet(std::string nt, int k) {
-    PFirsts = std::set<StrVec>(); // rule PFIRST set
+SeqSet Rule::pFirstSet(std::string nt, int k) {
+    PFirsts = SeqSet(); // rule PFIRST set
+    ConjPFirsts.clear();
 
-    int posConjNo = 0; // number of positive conjuncts in rule
+    int posConjNo = 0;       // number of positive conjuncts in rule
+    bool incomplete = false; // true if a positive conjunct has no sequences yet
     for (const GNode& conj : ConjList) {
-        std::set<StrVec> conjPFirsts = conj->pFirstSet(nt, k); // get PFIRST set of conjunct
-        if (!conjPFirsts.empty()) { // conjunct is positive
-            // Remove items from rule PFIRST set that are not in conjunct PFIRST set
-            for (auto it = PFirsts.begin(); it != PFirsts.end();) {
-                if (!conjPFirsts.contains(*it))
-                    it = PFirsts.erase(it);
-                else
-                    it++;
-            }
+        SeqSet conjPFirsts = conj->pFirstSet(nt, k); // get PFIRST set of conjunct
+        if (conj->isPositive()) {
+            incomplete = incomplete || conjPFirsts.empty();
+            ConjPFirsts.push_back(conjPFirsts);
 
-            if (PFirsts.empty() && (posConjNo == 0))
-                PFirsts = conjPFirsts; // start with PFIRST set of first positive conjunct
+            // Start with PFIRST set of first positive conjunct, then remove items that are not in the others
+            PFirsts = (posConjNo == 0) ? conjPFirsts : setIntersection(PFirsts, conjPFirsts);
             posConjNo++;
         }
     }
@@ -269,7 +619,7 @@ std::set<StrVec> Rule::pFirstSet(std::string nt, int k) {
     if (posConjNo == 0) {
         if (allFirsts.empty()) {
             for (const std::string s : alphabet)
-                allFirsts.insert({s}); // start with alphabet
+                allFirsts.insert({terminalClasses[s]}); // start with alphabet (one terminal per class)
 
             for (int i = 0; i < k; i++) {
                 allFirsts.insert({""});
@@ -280,32 +630,306 @@ std::set<StrVec> Rule::pFirstSet(std::string nt, int k) {
     }
 
     /* If rule's positive conjuncts are contradictory, all the elements in the PFIRST set
-     * will have been removed */
-    if (PFirsts.empty()) {
-        std::cout << "Error: conjuncts in rule for non-terminal " + nt + " are contradictory\n";
-        exit(1); // quit, since grammar is invalid
-    }
+     * will have been removed (if a conjunct has no sequences yet, the set is only
+     * incomplete) */
+    if (PFirsts.empty() && !incomplete)
+        contradictoryNts.push_back(nt);
     return PFirsts;
 }
 
+/* Compute sequences added to PFIRST set of rule by sequences added to non-terminals' sets
+ * (deltas): the sequences added to one positive conjunct that are in all the others
+ * A rule without positive conjuncts does not depend on other sets, so nothing is added */
+SeqSet Rule::pFirstDelta(std::string nt, int k, const SeqSets& deltas) {
+    if (ConjPFirsts.empty())
+        return SeqSet();
+
+    std::vector<SeqSet> conjAdded;
+    size_t posConjNo = 0;
+    for (const GNode& conj : ConjList) {
+        if (conj->isPositive()) {
+            conjAdded.push_back(setDifference(conj->pFirstDelta(nt, k, deltas), ConjPFirsts[posConjNo]));
+            ConjPFirsts[posConjNo++].insert(conjAdded.back());
+        }
+    }
+
+    SeqSet added;
+    bool incomplete = false;
+    for (size_t i = 0; i < conjAdded.size(); i++) {
+        incomplete = incomplete || ConjPFirsts[i].empty();
+        if (conjAdded[i].empty())
+            continue;
+        SeqSet seqs = conjAdded[i];
+        for (size_t j = 0; j < ConjPFirsts.size(); j++) {
+            if (j != i)
+                seqs = setIntersection(seqs, ConjPFirsts[j]);
+        }
+        added.insert(seqs);
+    }
+    added = setDifference(added, PFirsts);
+    PFirsts.insert(added);
+
+    if (PFirsts.empty() && !incomplete)
+        contradictoryNts.push_back(nt);
+    return added;
+}
+
 // Compute PFIRST set of disjunction (union of rules' PFIRST sets)
-std::set<StrVec> Disj::pFirstSet(std::string nt, int k) {
-    std::set<StrVec> pFirsts;
+SeqSet Disj::pFirstSet(std::string nt, int k) {
+    SeqSet pFirsts;
 
     // Add elements of each rule's PFIRST set to disjunction PFIRST set
-    for (const GNode& rule : RuleList) {
-        std::set<StrVec> rulePFirsts = rule->pFirstSet(nt, k);
-        pFirsts.insert(rulePFirsts.cbegin(), rulePFirsts.cend());
-    }
+    for (const GNode& rule : RuleList)
+        pFirsts.insert(rule->pFirstSet(nt, k));
     return pFirsts;
 }
 
+// Compute sequences added to PFIRST set of disjunction (union of those added to rules)
+SeqSet Disj::pFirstDelta(std::string nt, int k, const SeqSets& deltas) {
+    SeqSet added;
+    for (const GNode& rule : RuleList)
+        added.insert(rule->pFirstDelta(nt, k, deltas));
+    return added;
+}
+
+/* PFIRST sets kept between requests by the generator server and watch mode (server.cpp)
+ * The sets of a non-terminal's rules only depend on k, the alphabet, and the rules of the
+ * non-terminals it reaches, so a hash of those is its key; a request for an edited grammar
+ * then only computes the sets of non-terminals that reach an edited rule
+ * Entries hold the sets of the non-terminal's rules, packed by packSeqSets */
+std::map<std::string, std::string> pFirstCache;
+FILE *pFirstCacheFile = NULL; // where a request writes the entries it computed (NULL if not serving)
+
+// 128-bit hash of string (FNV-1a, and a multiplicative hash), as 32 hex digits
+static std::string wideHash(const std::string& str) {
+    uint64_t h1 = 14695981039346656037ull, h2 = 0;
+    for (unsigned char c : str) {
+        h1 = (h1 ^ c) * 1099511628211ull;
+        h2 = (h2 + c + 1) * 0x9e3779b97f4a7c15ull;
+        h2 ^= h2 >> 29;
+    }
+    char digits[33];
+    snprintf(digits, sizeof(digits), "%016llx%016llx", (unsigned long long) h1, (unsigned long long) h2);
+    return digits;
+}
+
+/* Cache keys of non-terminals, found with Tarjan's algorithm for strongly connected
+ * components: components are finished in reverse topological order, so the keys of the
+ * components one references are known when it is finished; non-terminals in a component
+ * (which recurse through each other) have the same hash, followed by their own name */
+struct PFirstCacheKeys {
+    std::map<std::string, GNode>& grammar;
+    std::map<std::string, StrSet>& ntRefs;
+    std::string base; // k and alphabet
+    std::map<std::string, size_t> indices, lowLinks;
+    StrVec stack;
+    StrSet onStack;
+    std::map<std::string, std::string> hashes; // hash of each non-terminal's component
+    std::map<std::string, std::string> keys;
+
+    void visit(const std::string& nt) {
+        size_t index = indices.size();
+        indices[nt] = lowLinks[nt] = index;
+        stack.push_back(nt);
+        onStack.insert(nt);
+        for (const std::string& ref : ntRefs[nt]) {
+            if (grammar.count(ref) == 0)
+                continue;
+            if (indices.count(ref) == 0) {
+                visit(ref);
+                lowLinks[nt] = std::min(lowLinks[nt], lowLinks[ref]);
+            } else if (onStack.count(ref) > 0) {
+                lowLinks[nt] = std::min(lowLinks[nt], indices[ref]);
+            }
+        }
+        if (lowLinks[nt] != indices[nt])
+            return;
+
+        // nt starts a component: hash its rules with the hashes of the components it references
+        StrSet members;
+        std::string member;
+        do {
+            member = stack.back();
+            stack.pop_back();
+            onStack.erase(member);
+            members.insert(member);
+        } while (member != nt);
+        std::string text = base;
+        StrSet refHashes;
+        for (const std::string& m : members) {
+            std::string rules = grammar[m]->toString(0);
+            text += std::to_string(m.length()) + ":" + m + std::to_string(rules.length()) + ":" + rules;
+            for (const std::string& ref : ntRefs[m]) {
+                if ((members.count(ref) == 0) && (hashes.count(ref) > 0))
+                    refHashes.insert(hashes[ref]);
+            }
+        }
+        for (const std::string& refHash : refHashes)
+            text += refHash;
+        std::string hash = wideHash(text);
+        for (const std::string& m : members) {
+            hashes[m] = hash;
+            keys[m] = hash + " " + m;
+        }
+    }
+};
+
+/* Pack sets of sequences into a string: number of sets, then for each set its size and its
+ * sequences, each as its length and its symbols (each as length, ':' and text) */
+static std::string packSeqSets(const std::vector<SeqSet>& sets) {
+    std::string packed = std::to_string(sets.size()) + "\n";
+    for (const SeqSet& set : sets) {
+        packed += std::to_string(set.size()) + "\n";
+        set.forEach([&](const StrVec& seq) {
+            packed += std::to_string(seq.size());
+            for (const std::string& symb : seq)
+                packed += " " + std::to_string(symb.length()) + ":" + symb;
+            packed += "\n";
+        });
+    }
+    return packed;
+}
+
+// Unpack sets of sequences packed by packSeqSets; return false if packed string is invalid
+static bool unpackSeqSets(const std::string& packed, std::vector<SeqSet>& sets) {
+    std::istringstream in(packed);
+    size_t setCount, seqCount, seqLength, symbLength;
+    if (!(in >> setCount))
+        return false;
+    sets.assign(setCount, SeqSet());
+    for (SeqSet& set : sets) {
+        if (!(in >> seqCount))
+            return false;
+        for (size_t seqNo = 0; seqNo < seqCount; seqNo++) {
+            StrVec seq;
+            if (!(in >> seqLength))
+                return false;
+            for (size_t symbNo = 0; symbNo < seqLength; symbNo++) {
+                if (!(in >> symbLength) || (in.get() != ':') || (symbLength > packed.length()))
+                    return false;
+                std::string symb(symbLength, '\0');
+                if (!in.read(symb.data(), symbLength))
+                    return false;
+                seq.push_back(symb);
+            }
+            set.insert(seq);
+        }
+    }
+    return true;
+}
+
+/* Compute PFIRST sets of non-terminals, given in topological order
+ * A recursive non-terminal sees its own set, or that of a later one (by indirect
+ * recursion, e.g. through brackets in expressions), before it is complete; sets only
+ * grow, since a set not yet computed has no sequences, so a worklist is used: each
+ * non-terminal is computed once in order, then again whenever a set it references grows,
+ * until none does
+ * Computing a non-terminal again only uses the sequences added to the sets it references
+ * since it was last computed (semi-naive evaluation, which also expands self-recursion)
+ * Without recursion, each non-terminal is computed once
+ * Contradictory rules are those found by the last computation of each non-terminal */
+void pFirstCompute(std::map<std::string, GNode>& grammar, const StrVec& ntOrder, std::map<std::string, StrSet>& ntRefs, int k) {
+    std::map<std::string, size_t> orderNos;
+    std::map<std::string, std::vector<size_t>> dependents; // non-terminals referencing each one
+    for (size_t i = 0; i < ntOrder.size(); i++) {
+        orderNos[ntOrder[i]] = i;
+        pFirstSets[ntOrder[i]] = SeqSet();
+    }
+    for (const std::string& s : ntOrder) {
+        for (const std::string& ref : ntRefs[s])
+            dependents[ref].push_back(orderNos[s]);
+    }
+
+    /* With the generator server, non-terminals whose key has an entry take their sets from
+     * it; these only reach others that do, so they are never computed */
+    PFirstCacheKeys cacheKeys = {grammar, ntRefs};
+    std::vector<bool> cached(ntOrder.size(), false);
+    if (pFirstCacheFile != NULL) {
+        StrSet classes;
+        for (const std::string& s : alphabet)
+            classes.insert(terminalClasses[s]);
+        cacheKeys.base = std::to_string(k) + "\n";
+        for (const std::string& s : classes)
+            cacheKeys.base += std::to_string(s.length()) + ":" + s;
+        for (const std::string& s : ntOrder) {
+            if (cacheKeys.indices.count(s) == 0)
+                cacheKeys.visit(s);
+        }
+        for (size_t i = 0; i < ntOrder.size(); i++) {
+            const std::string& s = ntOrder[i];
+            auto entry = pFirstCache.find(cacheKeys.keys[s]);
+            GNodeList rules = grammar[s]->getChildren();
+            std::vector<SeqSet> ruleSets;
+            if ((entry == pFirstCache.end()) || !unpackSeqSets(entry->second, ruleSets) || (ruleSets.size() != rules.size()))
+                continue;
+            for (size_t ruleNo = 0; ruleNo < rules.size(); ruleNo++) {
+                pFirstSets[s].insert(ruleSets[ruleNo]);
+                rules[ruleNo]->setPFirsts(ruleSets[ruleNo]);
+            }
+            cached[i] = true;
+        }
+    }
+
+    contradictoryNts.clear();
+    std::vector<bool> computed = cached;
+    std::vector<SeqSets> deltas(ntOrder.size()); // sequences added to referenced sets since each was computed
+    std::set<size_t> worklist; // non-terminals to compute, by number in ordering
+    for (size_t i = 0; i < ntOrder.size(); i++) {
+        if (!cached[i])
+            worklist.insert(i);
+    }
+    while (!worklist.empty()) {
+        size_t orderNo = *worklist.begin();
+        const std::string& s = ntOrder[orderNo];
+        worklist.erase(worklist.begin());
+        std::erase(contradictoryNts, s);
+        SeqSet added;
+        if (!computed[orderNo]) {
+            added = grammar[s]->pFirstSet(s, k);
+            computed[orderNo] = true;
+        } else {
+            added = setDifference(grammar[s]->pFirstDelta(s, k, deltas[orderNo]), pFirstSets[s]);
+        }
+        deltas[orderNo].clear();
+
+        if (!added.empty()) {
+            pFirstSets[s].insert(added);
+            for (size_t dependent : dependents[s]) {
+                if (computed[dependent])
+                    deltas[dependent][s].insert(added);
+                worklist.insert(dependent);
+            }
+        }
+    }
+
+    // Pass sets of non-terminals computed for the server back to it (as key and entry lengths, key, entry)
+    if (pFirstCacheFile != NULL) {
+        for (size_t i = 0; i < ntOrder.size(); i++) {
+            const std::string& s = ntOrder[i];
+            if (cached[i] || (std::find(contradictoryNts.cbegin(), contradictoryNts.cend(), s) != contradictoryNts.cend()))
+                continue;
+            std::vector<SeqSet> ruleSets;
+            for (const GNode& rule : grammar[s]->getChildren())
+                ruleSets.push_back(rule->getPFirsts());
+            std::string key = cacheKeys.keys[s], entry = packSeqSets(ruleSets);
+            fprintf(pFirstCacheFile, "%zu %zu\n", key.length(), entry.length());
+            fwrite(key.data(), 1, key.length(), pFirstCacheFile);
+            fwrite(entry.data(), 1, entry.length(), pFirstCacheFile);
+        }
+        fflush(pFirstCacheFile);
+    }
+}
+
 //----------------------//
 // Compute PFOLLOW Sets //
 //----------------------//
 
-// Build PFOLLOW sets of non-terminals used in conjunct
-void Conjunct::pFollowAdd(std::string nt, int k) const {
+/* Build PFOLLOW sets of non-terminals used in conjunct
+ * Sequences are added to partialPFollows rather than the global PFOLLOW sets, so that
+ * non-terminals can be processed in parallel; the PFOLLOW set of the deriving non-terminal
+ * is ntPFollows (its global set, or only the sequences added to it since it was last
+ * processed) plus anything already added to its partial set */
+void Conjunct::pFollowAdd(std::string nt, int k, const SeqSet& ntPFollows, SeqSets& partialPFollows) const {
     size_t conjSize = Symbols.size();
     size_t nextIndex;
 
@@ -317,7 +941,7 @@ void Conjunct::pFollowAdd(std::string nt, int k) const {
         if (current.type == NON_TERM) {
             nextIndex = i + 1;
             std::string cStr = current.str;
-            std::set<StrVec> partialPFollow = std::set<StrVec>();
+            SeqSet partialPFollow = SeqSet();
 
             // Add to partial PFOLLOW set until end of conjunct reached
             while (nextIndex < conjSize) {
@@ -325,7 +949,7 @@ void Conjunct::pFollowAdd(std::string nt, int k) const {
 
                 // Append terminal to each sequence in partial PFOLLOW set with length < k
                 if (next.type == LITERAL) {
-                    std::set<StrVec> nextSeq;
+                    SeqSet nextSeq;
                     nextSeq.insert({next.str});
                     partialPFollow = allConcat(partialPFollow, nextSeq, k);
 
@@ -334,7 +958,7 @@ void Conjunct::pFollowAdd(std::string nt, int k) const {
                  * Add sequence consisting of first k symbols of result to a new set
                  * Replace partial PFOLLOW set with this new set */
                 } else if (next.type == NON_TERM) {
-                    partialPFollow = allConcat(partialPFollow, pFirstSets[next.str], k);
+                    partialPFollow = allConcat(partialPFollow, pFirstSets.at(next.str), k);
                 }
 
                 nextIndex++; // go to next symbol
@@ -343,106 +967,319 @@ void Conjunct::pFollowAdd(std::string nt, int k) const {
             /* When end of conjunct is reached, if current is the deriving non-terminal,
              * recursively expand set k times */
             if (cStr == nt) {
-                for (int i = 0; i < k; i++) {
-                    std::set<StrVec> pFollowsPlusE = partialPFollow;
-                    pFollowsPlusE.insert({""});
-                    partialPFollow = allConcat(pFollowsPlusE, partialPFollow, k);
-                }
+                partialPFollow = selfConcat(partialPFollow, k);
             /* Otherwise, concatenate each sequence in PFOLLOW set of the deriving non-
              * terminal with each sequence in current's PFOLLOW set
              * Add sequence consisting of first k symbols of result to a new set
              * Replace PFOLLOW set with this new set */
             } else {
-                partialPFollow = allConcat(partialPFollow, pFollowSets[nt], k);
+                SeqSet derivingPFollows = ntPFollows;
+                if (partialPFollows.count(nt) > 0)
+                    derivingPFollows.insert(partialPFollows[nt]);
+                partialPFollow = allConcat(partialPFollow, derivingPFollows, k);
             }
 
-            if (pFollowSets.count(cStr) == 0)
-                pFollowSets[cStr] = std::set<StrVec>(); // create set if it does not exist
-            pFollowSets[cStr].insert(partialPFollow.cbegin(), partialPFollow.cend());
+            partialPFollows[cStr].insert(partialPFollow);
         }
     }
     return;
 }
 
 // Build PFOLLOW sets of non-terminals used in rule (for each conjunct, add to sets)
-void Rule::pFollowAdd(std::string nt, int k) const {
+void Rule::pFollowAdd(std::string nt, int k, const SeqSet& ntPFollows, SeqSets& partialPFollows) const {
     for (const GNode& conj : ConjList)
-        conj->pFollowAdd(nt, k);
+        conj->pFollowAdd(nt, k, ntPFollows, partialPFollows);
     return;
 }
 
 // Build PFOLLOW sets of non-terminals used in disjunction (for each rule, add to sets)
-void Disj::pFollowAdd(std::string nt, int k) const {
+void Disj::pFollowAdd(std::string nt, int k, const SeqSet& ntPFollows, SeqSets& partialPFollows) const {
     for (const GNode& rule : RuleList)
-        rule->pFollowAdd(nt, k);
+        rule->pFollowAdd(nt, k, ntPFollows, partialPFollows);
     return;
 }
 
+/* Compute PFOLLOW sets of non-terminals, given in reverse topological order
+ * Gives the same sets as processing the non-terminals one at a time in this order, where
+ * each non-terminal sees the sequences added by the non-terminals before it
+ * Non-terminals are split into waves: a non-terminal goes in the wave after the latest
+ * wave containing an earlier non-terminal that references it
+ * Non-terminals in the same wave are processed in parallel, each adding to its own partial
+ * sets, which are merged into the global sets at the end of the wave
+ * Sequences added to a non-terminal that comes earlier in the ordering (by recursion) are
+ * held back until that non-terminal has been processed */
+void pFollowCompute(std::map<std::string, GNode>& grammar, const StrVec& ntOrder, std::map<std::string, StrSet>& ntRefs, int k) {
+    std::map<std::string, size_t> orderNos, waveNos;
+    size_t waveCount = 0;
+    for (size_t i = 0; i < ntOrder.size(); i++) {
+        const std::string& s = ntOrder[i];
+        orderNos[s] = i;
+        waveNos[s] = 0;
+        pFollowSets[s] = SeqSet(); // create all sets before parallel phase
+        if (i == 0)
+            pFollowSets[s].insert({""}); // PFOLLOW set of start symbol is just epsilon
+    }
+
+    // Push each non-terminal's wave number onto the later non-terminals it references
+    for (const std::string& s : ntOrder) {
+        for (const std::string& ref : ntRefs[s]) {
+            if (orderNos[ref] > orderNos[s])
+                waveNos[ref] = std::max(waveNos[ref], waveNos[s] + 1);
+        }
+        waveCount = std::max(waveCount, waveNos[s] + 1);
+    }
+
+    // Non-terminals in each wave, in ordering
+    std::vector<StrVec> waves(waveCount);
+    for (const std::string& s : ntOrder)
+        waves[waveNos[s]].push_back(s);
+
+    /* With indirect recursion, sequences added to a non-terminal after it has been processed
+     * have not been passed on to the non-terminals it derives, so such non-terminals are
+     * processed again, in further passes over the waves, until no set grows; a set's
+     * sequences only reach the sets it derives by concatenation, so processing again only
+     * passes on the sequences added since (semi-naive evaluation) */
+    StrVec forwardOrder(ntOrder.rbegin(), ntOrder.rend());
+    bool indirect = refersForward(forwardOrder, ntRefs);
+    StrSet pending(ntOrder.cbegin(), ntOrder.cend()); // non-terminals whose sets grew since they were processed
+    SeqSets added; // sequences added to each pending set since it was processed
+    auto merge = [&](const std::string& target, const SeqSet& seqs) {
+        if (!indirect) {
+            pFollowSets[target].insert(seqs);
+            return;
+        }
+        SeqSet newSeqs = setDifference(seqs, pFollowSets[target]);
+        if (!newSeqs.empty()) {
+            pFollowSets[target].insert(newSeqs);
+            added[target].insert(newSeqs);
+            pending.insert(target);
+        }
+    };
+    for (bool firstPass = true; !pending.empty(); firstPass = false) {
+        std::vector<SeqSets> heldBack(waveCount); // sequences to be merged after each wave
+        size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t wave = 0; wave < waveCount; wave++) {
+            StrVec waveNts;
+            std::vector<const SeqSet *> ntPFollows; // set of each non-terminal in wave to pass on
+            SeqSets passOn; // sequences added since they were processed, after the first pass
+            for (const std::string& s : waves[wave]) {
+                if (pending.erase(s) > 0) {
+                    waveNts.push_back(s);
+                    if (!firstPass) {
+                        passOn[s] = std::move(added[s]);
+                        added.erase(s);
+                    }
+                    ntPFollows.push_back(firstPass ? &pFollowSets[s] : &passOn[s]);
+                }
+            }
+
+            // Each thread takes every threadCount-th non-terminal in the wave
+            std::vector<SeqSets> partials(waveNts.size());
+            std::vector<std::thread> threads;
+            for (size_t t = 0; (t < threadCount) && (t < waveNts.size()); t++) {
+                threads.emplace_back([&, t]() {
+                    for (size_t i = t; i < waveNts.size(); i += threadCount)
+                        grammar.at(waveNts[i])->pFollowAdd(waveNts[i], k, *ntPFollows[i], partials[i]);
+                });
+            }
+            for (std::thread& thread : threads)
+                thread.join();
+
+            // Merge partial sets in ordering, holding back sets for unprocessed non-terminals
+            for (size_t i = 0; i < waveNts.size(); i++) {
+                for (const auto& partial : partials[i]) {
+                    const std::string& target = partial.first;
+                    size_t mergeWave = wave;
+                    if (orderNos[target] <= orderNos[waveNts[i]])
+                        mergeWave = std::max(wave, waveNos[target]);
+
+                    if (mergeWave == wave)
+                        merge(target, partial.second);
+                    else
+                        heldBack[mergeWave][target].insert(partial.second);
+                }
+            }
+            for (const auto& held : heldBack[wave])
+                merge(held.first, held.second);
+        }
+    }
+}
+
 //-----------------------//
 // Compute Parsing Table //
 //-----------------------//
 
 int ruleNo = 0;
 std::map<int, GNodeList> rules; // give number to each rule
+std::map<int, std::string> ruleNts; // non-terminal deriving each rule
+
+/* Give each rule a name for generated code, made from its non-terminal and a hash of its
+ * conjuncts, so names do not change when other rules are added or removed */
+std::map<int, std::string> ruleNames;
+StrSet usedRuleNames;
+
+// FNV-1a hash of string, as 8 hex digits
+std::string hashStr(const std::string& str) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned char c : str) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08llx", hash & 0xffffffffULL);
+    return hex;
+}
 
-// Parsing table, maps pair of non-terminal and sequence to rule number
-std::map<std::pair<std::string, std::string>, int> parseTable;
+/* Rules of each non-terminal, with their numbers
+ * The parsing table is not kept whole, since with large PFIRST/PFOLLOW sets it would not
+ * fit in memory; the entries of a non-terminal are made from its rules' PFIRST sets and
+ * its PFOLLOW set (streamed from disk if they are large) when they are asked for */
+std::map<std::string, std::vector<std::pair<int, GNode>>> ntRules;
+int tableK = 1; // k of parsing table
 
-// Update parsing table by adding the given rule to entries
-void Rule::updateTable(std::string nt, int k) {
+// Number and name the given rule
+void Rule::numberRules(std::string nt) {
     GNodeList conjuncts;
     for (const GNode& conj : ConjList)
         conjuncts.push_back(conj);
     rules[ruleNo] = conjuncts; // assign number to list of conjuncts
 
-    /* All possible terminal sequences to which this rule could be applied:
-     * Concatenate each sequence in rule's PFIRST set with each sequence in nt's PFOLLOW set
-     * Truncate each resulting sequence to k symbols, and add it to set */
-    std::set<StrVec> sequences = allConcat(PFirsts, pFollowSets[nt], k);
-
-    // For each sequence, add the rule to the parsing table entry for nt and this sequence
-    for (StrVec v : sequences) {
-        std::string seqStr = "";
-        for (std::string str : v)
-            seqStr += str;
-
-        std::pair<std::string, std::string> tableEntry = make_pair(nt, seqStr);
-        parseTable[tableEntry] = ruleNo;
-    }
+    // Name rule; if an identical rule for nt has already been named, add a suffix
+    std::string name = "rule_" + nt + "_" + hashStr(toString(0));
+    std::string uniqueName = name;
+    for (int i = 2; usedRuleNames.contains(uniqueName); i++)
+        uniqueName = name + "_" + std::to_string(i);
+    usedRuleNames.insert(uniqueName);
+    ruleNames[ruleNo] = uniqueName;
+    ruleNts[ruleNo] = nt;
     ruleNo++; // increment rule number to be used by next rule
     return;
 }
 
-// Build parsing table by adding each rule in disjunction to any suitable entries
-void Disj::updateTable(std::string nt, int k) {
-    for (const GNode& rule : RuleList)
-        rule->updateTable(nt, k);
+// Number each rule in disjunction, and record it as one of nt's rules
+void Disj::numberRules(std::string nt) {
+    for (const GNode& rule : RuleList) {
+        ntRules[nt].push_back(make_pair(ruleNo, rule));
+        rule->numberRules(nt);
+    }
     return;
 }
 
+/* Get parsing table entries of a non-terminal, mapping sequences to rule numbers
+ * The entries of the non-terminal last asked for are kept, so they are only made again
+ * when another non-terminal's have been asked for since */
+const TableRows& tableRows(const std::string& nt) {
+    static std::string rowsNt = "";
+    static TableRows rows;
+    if ((nt == rowsNt) && !rows.bySeq.empty())
+        return rows;
+    rowsNt = nt;
+    rows = TableRows();
+
+    /* All possible terminal sequences to which each rule could be applied:
+     * Concatenate each sequence in rule's PFIRST set with each sequence in nt's PFOLLOW set
+     * Truncate each resulting sequence to k symbols, and add it to set
+     * A sequence that several rules could be applied to gets the last of them */
+    for (const auto& rule : ntRules[nt]) {
+        SeqSet sequences = allConcat(rule.second->getPFirsts(), pFollowSets[nt], tableK);
+
+        // For each sequence, add the rule to the parsing table entry for nt and this sequence
+        sequences.forEach([&](const StrVec& v) {
+            std::string seqStr = "";
+            for (std::string str : v)
+                seqStr += str;
+            rows.bySeqStr[seqStr] = rule.first;
+            rows.bySeq[v] = rule.first;
+        });
+    }
+    return rows;
+}
+
 //-------------//
 // Main Driver //
 //-------------//
 
-int main(int argc, char **argv) {
-    int k;
-    if (argc == 3) {
-        inpFile = fopen(argv[1], "r"); // get input file
-        if (inpFile == NULL) {
-            std::cout << "Error opening file\n";
-            return 1;
-        }
-        k = atoi(argv[2]); // get value of k
-        if (k < 1) {
-            std::cout << "k cannot be less than 1\n";
+/* Run generator on grammar in inpFile, with arguments k and options
+ * Print grammar AST, PFIRST/PFOLLOW sets and parsing table, and write parser code to
+ * parserFile; return exit status */
+int generate(const StrVec& args, std::ostream& parserFile) {
+    int k = atoi(args[0].c_str()); // get value of k
+    if (k < 1) {
+        std::cout << "k cannot be less than 1\n";
+        return 1;
+    }
+
+    // Read options
+    bool lookaheadDFA = false;     // if true, choose rules using lookahead DFAs
+    size_t spillLimit = 1 << 20; // most sequences a PFIRST/PFOLLOW set holds in memory
+    bool regular = false;          // if true, compile regular non-terminals to DFAs
+    size_t regularLimit = 256;     // most states of a DFA for a regular non-terminal
+    bool compound = false;         // if true, lift regular non-terminals into compound tokens
+    bool batch = false;            // if true, generate batch recogniser for start symbol
+    bool succinct = false;         // if true, parser can write trees in succinct form
+    bool dag = false;              // if true, parser can print trees with shared nodes once
+    bool exportTrees = false;      // if true, parser can write trees as JSON or S-expressions
+    size_t memoLimit = 0;          // most memo entries parser keeps in memory (0 for no limit)
+    int checkpointInterval = 0;    // seconds between parser's checkpoints (0 for none)
+    bool fuzz = false;             // if true, parser can search for costly inputs
+    bool counters = false;         // if true, report performance counters, and parser can too
+    bool allocations = false;      // if true, report allocations, and parser can too
+    for (size_t i = 1; i < args.size(); i++) {
+        if (args[i] == "--dfa") {
+            lookaheadDFA = true;
+        } else if (args[i] == "--regular") {
+            regular = true;
+        } else if (args[i] == "--compound-tokens") {
+            compound = true;
+        } else if (args[i] == "--batch") {
+            regular = true; // batch recogniser runs start symbol's DFA
+            batch = true;
+        } else if (args[i] == "--succinct") {
+            succinct = true;
+        } else if (args[i] == "--dag") {
+            dag = true;
+        } else if (args[i] == "--export") {
+            exportTrees = true;
+        } else if (args[i] == "--fuzz") {
+            fuzz = true;
+        } else if (args[i] == "--counters") {
+            counters = true;
+        } else if (args[i] == "--allocations") {
+            allocations = true;
+        } else if (args[i].starts_with("--regular-limit=") && (atoll(args[i].c_str() + 16) > 0)) {
+            regularLimit = atoll(args[i].c_str() + 16);
+        } else if (args[i].starts_with("--spill-limit=") && (atoll(args[i].c_str() + 14) > 0)) {
+            spillLimit = atoll(args[i].c_str() + 14);
+        } else if (args[i].starts_with("--memo-limit=") && (atoll(args[i].c_str() + 13) > 1)) {
+            memoLimit = atoll(args[i].c_str() + 13);
+        } else if (args[i].starts_with("--checkpoint=") && (atoi(args[i].c_str() + 13) > 0)) {
+            checkpointInterval = atoi(args[i].c_str() + 13);
+        } else {
+            std::cout << "Unknown option " + args[i] + "\n";
             return 1;
         }
-    } else {
-        std::cout << "Usage: ./code <input file> <k>\n";
+    }
+    if (fuzz && (memoLimit > 0)) {
+        std::cout << "--fuzz cannot be used with --memo-limit, as fuzzing clears the memo between inputs\n";
         return 1;
     }
 
+    // Count hardware events, time and allocations in each phase, per byte of grammar
+    std::optional<PerfCounters> perf;
+    struct stat grammarStat;
+    size_t grammarSize = (fstat(fileno(inpFile), &grammarStat) == 0) ? grammarStat.st_size : 0;
+    auto phase = [&](const char *name) {
+        if (perf)
+            perf->start(name);
+        allocationPhase(name);
+    };
+    if (counters)
+        perf.emplace();
+    if (allocations)
+        trackAllocations();
+
     // Parse input file
+    phase("reading grammar");
     std::map<std::string, GNode> grammar = parseGrammar();
     fclose(inpFile);
 
@@ -451,6 +1288,39 @@ int main(int argc, char **argv) {
     for (const auto& disj : grammar)
         std::cout << "NON-TERMINAL " + disj.first + "\n" + disj.second->toString(0);
 
+    /* Lift non-terminals with regular sub-grammars over characters into compound tokens,
+     * and print the number of states of each token's DFA */
+    if (compound) {
+        phase("compound tokens");
+        std::map<std::string, StrSet> ntRefs;
+        for (const auto& disj : grammar)
+            ntRefs[disj.first] = disj.second->references();
+        grammar = liftCompoundTokens(grammar, topologicalSort(ntRefs).back(), regularLimit);
+        visited.clear(); // grammar is sorted again below
+
+        if (!compoundTokens.empty())
+            std::cout << "\nCompound Tokens\n";
+        for (const auto& token : compoundTokens)
+            std::cout << token.first + ": " + std::to_string((token.second).accept.size()) + " states\n";
+    }
+    initSeqSets(alphabet, k, spillLimit);
+
+    // Merge interchangeable terminals, and print each class with more than one terminal
+    phase("merging");
+    grammar = mergeTerminalClasses(grammar);
+    std::map<std::string, StrVec> classMembers;
+    for (const auto& term : terminalClasses)
+        classMembers[term.second].push_back(term.first);
+    bool classesMerged = false;
+    for (const auto& termClass : classMembers) {
+        if ((termClass.second).size() > 1) {
+            if (!classesMerged)
+                std::cout << "\nTerminal Classes\n";
+            std::cout << termClass.first + ":" + printStrs(termClass.second) + "\n";
+            classesMerged = true;
+        }
+    }
+
     /* Build adjacency list: map each non-terminal to set of non-terminals used in rules
      * derived from it */
     std::map<std::string, StrSet> ntRefs;
@@ -460,46 +1330,153 @@ int main(int argc, char **argv) {
     }
     StrVec ntOrder = topologicalSort(ntRefs); // compute topological ordering
 
+    /* Merge duplicate non-terminals; the grammar before merging is kept, for the names its
+     * rules use */
+    std::map<std::string, GNode> classGrammar = grammar;
+    grammar = mergeDuplicateNts(classGrammar, ntOrder);
+    std::erase_if(ntOrder, [](const std::string& nt) {return ntAliases.count(nt) > 0;});
+    for (const auto& alias : ntAliases)
+        ntRefs.erase(alias.first);
+    for (const std::string& nt : ntOrder)
+        ntRefs[nt] = grammar[nt]->references();
+
     // Compute PFIRST sets of non-terminals, in topological order
-    for (const std::string& s : ntOrder)
-        pFirstSets[s] = grammar[s]->pFirstSet(s, k);
+    phase("PFIRST/PFOLLOW sets");
+    pFirstCompute(grammar, ntOrder, ntRefs, k);
+    if (!contradictoryNts.empty()) {
+        std::cout << "Error: conjuncts in rule for non-terminal " + contradictoryNts[0] + " are contradictory\n";
+        exit(1); // quit, since grammar is invalid
+    }
 
-    // Compute PFOLLOW sets of non-terminals
+    // Compute PFOLLOW sets of non-terminals (first symbol in ordering is start symbol)
     std::reverse(ntOrder.begin(), ntOrder.end()); // reverse order of non-terminals
-    for (size_t i = 0; i < ntOrder.size(); i++) {
-        const std::string& s = ntOrder[i];
-        if (i == 0) { // first symbol in ordering is start symbol
-            pFollowSets[s] = std::set<StrVec>();
-            pFollowSets[s].insert({""}); // PFOLLOW set of start symbol is just epsilon
+    pFollowCompute(grammar, ntOrder, ntRefs, k);
+
+    // Print each non-terminal that others were merged into
+    std::map<std::string, StrVec> ntMembers;
+    for (const auto& disj : classGrammar)
+        ntMembers[(ntAliases.count(disj.first) > 0) ? ntAliases[disj.first] : disj.first].push_back(disj.first);
+    if (!ntAliases.empty()) {
+        std::cout << "\nMerged Non-Terminals\n";
+        for (const auto& members : ntMembers) {
+            if ((members.second).size() > 1)
+                std::cout << members.first + ":" + printStrs(members.second) + "\n";
         }
-        grammar[s]->pFollowAdd(s, k);
     }
 
     // Print PFIRST and PFOLLOW sets
     std::cout << "\nPFIRST Sets\n";
-    for (const std::string& s : ntOrder)
-        std::cout << s + ":" + printStrs(pFirstSets[s]) + "\n";
+    for (const std::string& s : ntOrder) {
+        std::cout << s + ":";
+        printSeqs(std::cout, pFirstSets[s]);
+        std::cout << "\n";
+    }
     std::cout << "\nPFOLLOW Sets\n";
-    for (const std::string& s : ntOrder)
-        std::cout << s + ":" + printStrs(pFollowSets[s]) + "\n";
+    for (const std::string& s : ntOrder) {
+        std::cout << s + ":";
+        printSeqs(std::cout, pFollowSets[s]);
+        std::cout << "\n";
+    }
 
-    // Build parsing table
-    for (const auto& disj : grammar)
-        disj.second->updateTable(disj.first, k);
+    /* Build parsing table, and record names used by references in each rule, for each
+     * non-terminal merged into the one deriving it */
+    phase("parsing table");
+    tableK = k;
+    for (const auto& disj : grammar) {
+        int firstRuleNo = ruleNo;
+        disj.second->numberRules(disj.first);
+        for (const std::string& member : ntMembers[disj.first]) {
+            std::vector<StrVec> refLists = classGrammar[member]->referenceLists();
+            for (size_t i = 0; i < refLists.size(); i++)
+                ruleRefNames[firstRuleNo + i][member] = refLists[i];
+        }
+    }
 
-    // Print parsing table
+    // Print parsing table, one non-terminal at a time
     std::cout << "\nLL(" + std::to_string(k) + ") Parsing Table\n";
-    for (const auto& entry : parseTable) {
-        std::string entryStr = "NON-TERMINAL " + (entry.first).first + ", SEQUENCE ";
-        if ((entry.first).second == "")
-            entryStr += "EPSILON\n";
-        else
-            entryStr += (entry.first).second + "\n";
-        std::cout << entryStr + makeIndent(1) + "RULE:\n" + nlString(rules[entry.second], 2);
+    for (const auto& disj : grammar) {
+        for (const auto& entry : tableRows(disj.first).bySeqStr) {
+            std::string entryStr = "NON-TERMINAL " + disj.first + ", SEQUENCE ";
+            if (entry.first == "")
+                entryStr += "EPSILON\n";
+            else
+                entryStr += entry.first + "\n";
+            std::cout << entryStr + makeIndent(1) + "RULE:\n" + nlString(rules[entry.second], 2);
+        }
+    }
+
+    /* Compile non-terminals with regular sub-grammars to DFAs, along with their PFOLLOW
+     * sets, which decide where a match may end */
+    if (regular) {
+        phase("regular DFAs");
+        compileRegularNts(grammar, regularLimit);
+        if (!regularDfas.empty())
+            std::cout << "\nRegular Non-Terminals\n";
+        for (const auto& dfa : regularDfas) {
+            followDfas[dfa.first] = sequenceDfa(pFollowSets[dfa.first]);
+            std::cout << dfa.first + ": " + std::to_string((dfa.second).accept.size()) + " states\n";
+        }
+    }
+
+    /* Batch recogniser runs start symbol's DFA over bytes, so start symbol must be compiled,
+     * and every terminal must be a single character */
+    if (batch && ((regularDfas.count(ntOrder[0]) == 0) || !compoundTokens.empty() || std::any_of(alphabet.cbegin(), alphabet.cend(), [](const std::string& s) {return s.length() != 1;}))) {
+        std::cout << "Error: batch recogniser needs start symbol " + ntOrder[0] + " to be regular, with single-character terminals\n";
+        return 1;
     }
 
     // Generate recursive descent parser code
+    phase("code generation");
     std::reverse(ntOrder.begin(), ntOrder.end()); // reverse order of non-terminals
-    RDCodegen(ntOrder, k);
+    RDCodegen(parserFile, ntOrder, k, lookaheadDFA, batch, succinct, dag, exportTrees, memoLimit, checkpointInterval, fuzz, counters, allocations);
+    if (perf) {
+        perf->stop();
+        perf->report({{"grammar byte", grammarSize}});
+    }
+    reportAllocations(grammarSize);
     return 0;
 }
+
+int main(int argc, char **argv) {
+    if ((argc == 3) && (std::string(argv[1]) == "--server"))
+        return runServer(argv[2]); // serve requests until killed
+
+    if (argc < 3) {
+        std::cout << "Usage: ./code <input file> <k> [--dfa] [--connect <socket> | --watch]\n";
+        std::cout << "       ./code --server <socket>\n";
+        return 1;
+    }
+
+    /* Get k and options, socket of server to forward request to (if any), and whether to
+     * watch grammar file for changes */
+    StrVec args;
+    std::string socketPath = "";
+    bool watch = false;
+    for (int i = 2; i < argc; i++) {
+        if ((std::string(argv[i]) == "--connect") && (i + 1 < argc))
+            socketPath = argv[++i];
+        else if (std::string(argv[i]) == "--watch")
+            watch = true;
+        else
+            args.push_back(argv[i]);
+    }
+
+    inpFile = fopen(argv[1], "r"); // get input file
+    if (inpFile == NULL) {
+        std::cout << "Error opening file\n";
+        return 1;
+    }
+    if (socketPath != "")
+        return runClient(socketPath, args);
+    if (watch) {
+        fclose(inpFile);
+        return runWatch(argv[1], args);
+    }
+
+    // Only write parser file if generation succeeds, and code has changed
+    std::ostringstream parserCode;
+    int status = generate(args, parserCode);
+    if (status == 0)
+        writeIfChanged("parser.cpp", parserCode.str());
+    return status;
+}
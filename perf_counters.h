@@ -0,0 +1,148 @@
+#pragma once
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <string>
+#include <sys/syscall.h>
+#include <tuple>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/* Hardware performance counters for the phases of a run, read with perf_event_open
+ * Each counter is opened on its own, so ones the machine or kernel does not provide are
+ * left out; if none can be opened, only wall-clock time is reported
+ * Counters count the calling thread and the threads it starts after they are opened (as
+ * the PFIRST/PFOLLOW phase does), in user mode; a thread's counts are added when it exits
+ * Generated parsers with --counters get the text of this header (see the Makefile), so it
+ * only uses C++17, which they may be compiled as */
+class PerfCounters {
+    private:
+        struct Phase {
+            std::string name;
+            double seconds = 0;
+            std::vector<double> counts; // count of each open counter, scaled for multiplexing
+        };
+
+        std::vector<int> fds;           // file descriptor of each open counter
+        std::vector<std::string> names; // name of each open counter
+        std::vector<Phase> phases;
+        bool running = false;
+        std::chrono::steady_clock::time_point startTime;
+        std::vector<uint64_t> startValues; // value, time enabled and time running of each counter
+
+        std::vector<uint64_t> readValues() const {
+            std::vector<uint64_t> values(3 * fds.size(), 0);
+            for (size_t i = 0; i < fds.size(); i++) {
+                if (read(fds[i], &values[3 * i], 3 * sizeof(uint64_t)) != 3 * sizeof(uint64_t))
+                    values[3 * i] = values[3 * i + 1] = values[3 * i + 2] = 0;
+            }
+            return values;
+        }
+
+    public:
+        PerfCounters() {
+            // Name, type and configuration of each counter
+            const uint64_t readMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            const std::vector<std::tuple<std::string, uint32_t, uint64_t>> counterTypes = {
+                {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+                {"L1D misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | readMiss},
+                {"LLC misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | readMiss},
+                {"dTLB misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | readMiss}
+            };
+            for (const auto& [name, type, config] : counterTypes) {
+                perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = type;
+                attr.config = config;
+                attr.exclude_kernel = 1; // needed when perf_event_paranoid is 2
+                attr.exclude_hv = 1;
+                attr.inherit = 1;        // also count threads started later, e.g. for PFIRST/PFOLLOW
+                attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+                if (fd >= 0) {
+                    fds.push_back(fd);
+                    names.push_back(name);
+                }
+            }
+        }
+
+        ~PerfCounters() {
+            for (int fd : fds)
+                close(fd);
+        }
+
+        // End current phase (if any), and start next one
+        void start(const std::string& phase) {
+            stop();
+            phases.push_back({phase, 0, std::vector<double>(fds.size(), 0)});
+            running = true;
+            startValues = readValues();
+            startTime = std::chrono::steady_clock::now(); // read last, so reading counters is not timed
+        }
+
+        // End current phase
+        void stop() {
+            if (!running)
+                return;
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+            std::vector<uint64_t> values = readValues();
+            Phase& phase = phases.back();
+            phase.seconds = elapsed.count();
+
+            /* A counter shares the hardware with others if there are too few registers, and
+             * only counts while it is running, so its count is scaled by time enabled over
+             * time running */
+            for (size_t i = 0; i < fds.size(); i++) {
+                uint64_t count = values[3 * i] - startValues[3 * i];
+                uint64_t enabled = values[3 * i + 1] - startValues[3 * i + 1];
+                uint64_t runTime = values[3 * i + 2] - startValues[3 * i + 2];
+                phase.counts[i] = (runTime > 0) ? (double)count * enabled / runTime : 0;
+            }
+            running = false;
+        }
+
+        // Print time and counts of each phase, and per unit for each unit (e.g. byte) with a non-zero number
+        void report(const std::vector<std::pair<std::string, size_t>>& units) const {
+            char number[64];
+            auto perUnit = [&](double total, const char *suffix) {
+                std::string result = "";
+                for (const auto& unit : units) {
+                    if (unit.second > 0) {
+                        snprintf(number, sizeof(number), "%.2f", total / unit.second);
+                        result += ", " + std::string(number) + suffix + " per " + unit.first;
+                    }
+                }
+                return result;
+            };
+
+            std::cout << "\nPerformance Counters\n";
+            if (fds.empty())
+                std::cout << "Hardware counters unavailable, so only wall-clock time is shown\n";
+            for (const Phase& phase : phases) {
+                std::string perNanosecond = perUnit(phase.seconds * 1e9, " ns");
+                snprintf(number, sizeof(number), "%.3f", phase.seconds * 1000);
+                std::cout << phase.name + ": " + number + " ms" + perNanosecond + "\n";
+                for (size_t i = 0; i < names.size(); i++) {
+                    std::string perCount = perUnit(phase.counts[i], "");
+                    snprintf(number, sizeof(number), "%.0f", phase.counts[i]);
+                    std::cout << "    " + names[i] + ": " + number + perCount + "\n";
+                }
+                if ((names.size() >= 2) && (names[0] == "cycles") && (names[1] == "instructions") && (phase.counts[0] > 0)) {
+                    snprintf(number, sizeof(number), "%.2f", phase.counts[1] / phase.counts[0]);
+                    std::cout << "    instructions per cycle: " + std::string(number) + "\n";
+                }
+            }
+        }
+};
+
+#endif
@@ -1,8 +1,10 @@
 #include <algorithm>
 #include <format>
-#include <fstream>
+#include <functional>
+#include <ostream>
 #include "grammar.h"
 #include "rd_codegen.h"
+#include "regular.h"
 
 //------------------------------------------//
 // Recursive Descent Parser Code Generation //
@@ -11,8 +13,9 @@
 /* Code that starts parser file
  * Token storage, parse tree classes and printing, error handling, terminal parsing
  * sentence holds the tokens generated by the lexer
- * pos, start and end keep track of parser position in input */
-static std::string beginningCode = R"(#include <iostream>
+ * pos keeps track of parser position in input */
+static std::string beginningCode = R"(#include <cstdint>
+#include <iostream>
 #include <map>
 #include <memory>
 #include <set>
@@ -30,12 +33,13 @@ std::string makeIndent(int depth) {
 
 struct TOKEN {
     std::string str;
-    int lineNo, columnNo;
+    int id, lineNo, columnNo;
 };
 
-TOKEN makeToken(std::string str, int lineNo, int columnNo) {
+TOKEN makeToken(std::string str, int id, int lineNo, int columnNo) {
     TOKEN token;
     token.str = str;
+    token.id = id;
     token.lineNo = lineNo;
     token.columnNo = columnNo - str.length() + 1;
     return token;
@@ -47,15 +51,41 @@ std::string displayPos(int lineNo, int columnNo) {
     return " [ln " + std::to_string(lineNo) + ", col " + std::to_string(columnNo) + "]";
 }
 
+class ParseNode;
+
+/* Receives the nodes of a parse tree in preorder; each non-terminal or conjunct entered is
+ * later left, and terminals and non-terminals with values have no children
+ * enter is called before each node, and the node is skipped if it returns false
+ * With --memo-limit, a subtree moved to disk is rebuilt to be walked, unless enterSpilled
+ * (given its offset on disk) returns false; leaveSpilled is called after it is walked */
+class TreeWalker {
+    public:
+        virtual ~TreeWalker() {}
+        virtual bool enter(const ParseNode *node) {return true;}
+        virtual void enterNonTerminal(const std::string& symbol) {}
+        virtual void enterConjunct() {}
+        virtual void leave() {}
+        virtual void terminal(const TOKEN& token) {}
+        virtual void value(const std::string& symbol, const std::string& value) {}
+        virtual bool enterSpilled(uint64_t offset) {return true;}
+        virtual void leaveSpilled() {}
+};
+
 class ParseNode {
     public:
         virtual ~ParseNode() {}
         virtual std::string toString(int depth) {return "";};
+        virtual void walk(TreeWalker& walker) {}
 };
 
 using PNode = std::shared_ptr<ParseNode>;
 using PNodeList = std::vector<PNode>;
 
+void walkTree(const PNode& node, TreeWalker& walker) {
+    if (node && walker.enter(node.get()))
+        node->walk(walker);
+}
+
 class Leaf: public ParseNode {
     TOKEN Symbol;
 
@@ -64,6 +94,9 @@ class Leaf: public ParseNode {
         std::string toString(int depth) override {
             return makeIndent(depth) + "TERMINAL" + displayPos(Symbol.lineNo, Symbol.columnNo) + ": " + Symbol.str + "\n";
         }
+        void walk(TreeWalker& walker) override {
+            walker.terminal(Symbol);
+        }
 };
 
 class Internal: public ParseNode {
@@ -72,6 +105,9 @@ class Internal: public ParseNode {
 
     public:
         Internal(std::string s, std::vector<PNodeList> c): Symbol(s), Children(std::move(c)) {}
+        const std::string& symbol() const {return Symbol;}
+        const std::vector<PNodeList>& children() const {return Children;}
+        void replaceChildren(std::vector<PNodeList> c) {Children = std::move(c);}
         std::string toString(int depth) override {
             std::string result = makeIndent(depth) + "NON-TERMINAL: " + Symbol;
             if (Children.empty())
@@ -86,17 +122,27 @@ class Internal: public ParseNode {
             }
             return result;
         }
+        void walk(TreeWalker& walker) override {
+            walker.enterNonTerminal(Symbol);
+            for (const auto& conjNodes : Children) {
+                walker.enterConjunct();
+                for (const PNode& n : conjNodes)
+                    walkTree(n, walker);
+                walker.leave();
+            }
+            walker.leave();
+        }
 };
 
 FILE *inputFile;
 std::vector<TOKEN> sentence;
-size_t pos, start, end;
+size_t pos;
 
 void tokenFail(bool wanted, std::string wrong, std::string expected) {
     if (!wanted)
         return;
 
-    std::string failPos = displayPos(sentence[pos].lineNo, sentence[pos].columnNo);
+    std::string failPos = (pos < sentence.size()) ? displayPos(sentence[pos].lineNo, sentence[pos].columnNo) : displayPos(0, 0);
     std::string failStr = (wrong == "") ? "EOF" : wrong;
     std::cout << "Parser error" + failPos + ": unexpected sequence " + failStr + ", expecting " + expected + "\n";
 }
@@ -115,11 +161,11 @@ void conjFail(bool wanted, size_t start, size_t end, bool posConj, std::string c
         std::cout << report + " is unwanted\n";
 }
 
-PNode terminal(bool wanted, std::string tokenStr) {
-    if (sentence[pos].str == tokenStr)
+PNode terminal(bool wanted, int id, std::string expected) {
+    if ((pos < sentence.size()) && (sentence[pos].id == id))
         return std::make_shared<Leaf>(sentence[pos++]);
 
-    tokenFail(wanted, sentence[pos].str, tokenStr);
+    tokenFail(wanted, (pos < sentence.size()) ? sentence[pos].str : "", expected);
     return nullptr;
 }
 
@@ -127,26 +173,213 @@ bool startsWith(std::string str, std::string prefix) {
     return (str.compare(0, prefix.length(), prefix) == 0);
 }
 
-std::map<std::pair<std::string, size_t>, PNode> memo;)";
+/* Result of a non-terminal at a position, and where it ended, so a hit moves on as parsing
+ * again would (secondary and negative conjuncts parse from the same position again) */
+struct MemoEntry {
+    PNode node;
+    size_t end;
+};
+
+std::map<std::pair<size_t, std::string>, MemoEntry> memo; // by position, then non-terminal
+
+/* Each non-terminal counts the memo hits in a window of calls, and if there are too few,
+ * stops using the memo for a pause, then samples it again; parsing again gives the same
+ * result, so this only changes the speed */
+const int memoWindow = 256;
+const int memoMinHits = 8;
+const int memoPause = 4096;
+
+struct MemoPolicy {
+    int calls = 0, hits = 0;
+    int pausedCalls = 0; // calls left before memo is used again
+
+    bool active() {
+        if (pausedCalls == 0)
+            return true;
+        pausedCalls--;
+        return false;
+    }
+
+    void record(bool hit) {
+        hits += hit;
+        if (++calls < memoWindow)
+            return;
+        if (hits < memoMinHits)
+            pausedCalls = memoPause;
+        calls = 0;
+        hits = 0;
+    }
+};)";
+
+/* Code for non-terminals with types, whose nodes hold the value computed by a semantic
+ * action instead of a subtree
+ * A value is shown with << if its type supports it */
+static std::string valueCode = R"(
+
+#include <sstream>
+#include <utility>
+
+template <typename T>
+auto showValue(const T& value, int) -> decltype(std::declval<std::ostream&>() << value, std::string()) {
+    std::ostringstream stream;
+    stream << value;
+    return stream.str();
+}
+
+template <typename T>
+std::string showValue(const T& value, long) {
+    return "[value]";
+}
+
+template <typename T>
+class ValueNode: public ParseNode {
+    std::string Symbol;
+
+    public:
+        T Value;
+        ValueNode(std::string s, T v): Symbol(s), Value(std::move(v)) {}
+        std::string toString(int depth) override {
+            return makeIndent(depth) + "NON-TERMINAL: " + Symbol + " = " + showValue(Value, 0) + "\n";
+        }
+        void walk(TreeWalker& walker) override {
+            walker.value(Symbol, showValue(Value, 0));
+        }
+};
+
+template <typename T>
+T& valueOf(const PNode& node) {
+    return static_cast<ValueNode<T>&>(*node).Value;
+}
+
+std::string tokenText(size_t from, size_t to) {
+    std::string text = "";
+    for (size_t i = from; i < to; i++)
+        text += sentence[i].str;
+    return text;
+})";
+
+/* Token ID of each terminal, which is the ID of its class (terminals in the same class are
+ * interchangeable, so the parser only needs to tell classes apart)
+ * Classes are numbered in alphabetical order of their representatives */
+static std::map<std::string, int> terminalIds;
+
+// How each class representative is shown in error messages (all terminals in its class)
+static std::map<std::string, std::string> classDisplays;
+
+// Whether the memo spills old positions to disk, and whether it is saved in checkpoints
+static bool memoSpilling = false;
+static bool memoCheckpoints = false;
+
+// Whether non-terminal functions count their cost and coverage for fuzzing
+static bool fuzzing = false;
+
+// Site number of each non-terminal function whose allocations are counted (from 1)
+static std::map<std::string, int> allocationSites;
+
+/* Non-terminals that duplicates have been merged into
+ * Their functions are passed the name the tree node should show, so that the tree still
+ * uses the names in the grammar */
+static StrSet mergedNts;
+
+/* Generate tables of the names children of a merged non-terminal's node have when it is
+ * wanted under another name, and code relabelling a node found in the memo with the name
+ * it is wanted under
+ * A child's name under one non-terminal is renamed to the name in the same place in the
+ * definition the others were merged into, and from that to the name under the other
+ * The names in a subtree only depend on the name of its root, so children whose names are
+ * the same are shared, and only those whose names differ are relabelled in turn; a child
+ * moved to disk is rebuilt to find its name, and kept as it was if its name is the same */
+static std::string aliasCode() {
+    std::string leaderNames = "", memberNames = "";
+    std::set<std::pair<std::string, std::string>> entries;
+    for (const auto& ruleEntry : ruleRefNames) {
+        const StrVec& leaderRefs = (ruleEntry.second).at(ruleNts[ruleEntry.first]);
+        for (const auto& member : ruleEntry.second) {
+            for (size_t i = 0; i < leaderRefs.size(); i++) {
+                const std::string& name = (member.second)[i];
+                if ((name != leaderRefs[i]) && entries.emplace(member.first, name).second) {
+                    leaderNames += std::format("    {{{{\"{}\", \"{}\"}}, \"{}\"}},\n", member.first, name, leaderRefs[i]);
+                    memberNames += std::format("    {{{{\"{}\", \"{}\"}}, \"{}\"}},\n", member.first, leaderRefs[i], name);
+                }
+            }
+        }
+    }
+
+    return std::format(R"(
+// Name in merged definition of each name referenced by a non-terminal merged into it, by non-terminal and name, and back
+std::map<std::pair<std::string, std::string>, std::string> leaderNames = {{
+{}}};
+std::map<std::pair<std::string, std::string>, std::string> memberNames = {{
+{}}};
+
+std::string aliasName(const std::map<std::pair<std::string, std::string>, std::string>& names, const std::string& nt, const std::string& name) {{
+    auto entry = names.find(std::make_pair(nt, name));
+    return (entry == names.end()) ? name : entry->second;
+}}
+
+PNode relabel(const PNode& node, const std::string& symbol) {{
+    Internal *internal = dynamic_cast<Internal *>(node.get());
+    if ((internal == nullptr) || (internal->symbol() == symbol))
+        return node;
+
+    std::vector<PNodeList> children = internal->children();
+    for (PNodeList& conjNodes : children) {{
+        for (PNode& child : conjNodes) {{
+{}            Internal *childInternal = dynamic_cast<Internal *>(childNode.get());
+            if (childInternal == nullptr)
+                continue;
+            std::string leaderName = aliasName(leaderNames, internal->symbol(), childInternal->symbol());
+            std::string name = aliasName(memberNames, symbol, leaderName);
+            if (name != childInternal->symbol())
+                child = relabel(childNode, name);
+        }}
+    }}
+    return std::make_shared<Internal>(symbol, std::move(children));
+}}
+)", leaderNames, memberNames, memoSpilling ? "            SpilledNode *spilled = dynamic_cast<SpilledNode *>(child.get());\n            PNode childNode = (spilled == nullptr) ? child : spilled->restore();\n" : "            const PNode& childNode = child;\n");
+}
 
-// Assign a number to each non-terminal
-static std::map<std::string, int> nonTerminalNos;
+/* Generate call to function of a non-terminal referenced by a rule
+ * refNames gives the name used by the reference for each non-terminal sharing the rule;
+ * if they differ, the name is chosen by the non-terminal being parsed (nt) */
+static std::string ntCall(const std::string& refNt, const std::map<std::string, StrVec>& refNames, size_t refNo, const std::string& wantedStr) {
+    if (mergedNts.count(refNt) == 0)
+        return "nonTerminal_" + refNt + "(" + wantedStr + ")";
+
+    std::string lastName = (refNames.rbegin()->second)[refNo];
+    std::string nameStr = "\"" + lastName + "\"";
+    for (auto member = refNames.crbegin(); member != refNames.crend(); member++) {
+        std::string name = (member->second)[refNo];
+        if (name != lastName)
+            nameStr = std::format("(nt == \"{}\") ? \"{}\" : {}", member->first, name, nameStr);
+    }
+    return std::format("nonTerminal_{}({}, {})", refNt, wantedStr, nameStr);
+}
 
-// Generate code for parsing a sequence of symbols
-static std::string parseSymbSeq(const SymbVec& symbols, bool posConj, size_t conjNo) {
+/* Generate code for parsing a sequence of symbols
+ * In a positive conjunct, each symbol's node is added to listName, and the code returns
+ * failValue if a symbol fails; a non-terminal made for an EBNF operator adds its children
+ * to listName itself, also in a negative conjunct, where the list is only thrown away
+ * The positions where each marked symbol starts and ends are kept, for semantic actions */
+static std::string parseSymbSeq(const SymbVec& symbols, bool posConj, const std::string& listName, const std::string& failValue, const std::map<std::string, StrVec>& refNames, size_t& refNo, const std::set<int>& marked) {
     std::string symbolSequence = "";
 
     int symbNo = 0;
     for (const SYMBOL& symb : symbols) {
         std::string symbFunction = "";
+        bool ebnf = (symb.type == NON_TERM) && (ebnfNts.count(symb.str) > 0);
         if (symb.type != EPSILON) {
             std::string wantedStr = "wanted";
             if (!posConj)
                 wantedStr = "!wanted";
-            if (symb.type == LITERAL)
-                symbFunction += "terminal(" + wantedStr + ", \"" + symb.str + "\"" + ")";
-            else
-                symbFunction += "nonTerminal" + std::to_string(nonTerminalNos[symb.str]) +"(" + wantedStr + ")";
+            if (symb.type == LITERAL) {
+                symbFunction += std::format("terminal({}, {}, \"{}\")", wantedStr, terminalIds[symb.str], classDisplays[symb.str]);
+            } else if (ebnf) {
+                symbFunction += std::format("nonTerminal_{}({}, {})", symb.str, wantedStr, listName);
+                refNo++;
+            } else {
+                symbFunction += ntCall(symb.str, refNames, refNo++, wantedStr);
+            }
         }
 
         if (symbFunction != "") {
@@ -159,15 +392,26 @@ static std::string parseSymbSeq(const SymbVec& symbols, bool posConj, size_t con
 
             /* If conjunct is positive, add a node for each symbol to the conjunct subtree
              * If one symbol function fails, whole conjunct fails */
+            } else if (ebnf) {
+                symbolSequence += std::format(
+R"(    if (!{})
+        return {};
+)",
+                symbFunction, failValue);
             } else {
-                std::string symbNode = std::format("conj{}node{}", conjNo, symbNo);
+                std::string symbNode = std::format("{}node{}", listName, symbNo);
+                bool mark = (marked.count(symbNo) > 0);
+                if (mark)
+                    symbolSequence += std::format("    size_t {}start{} = pos;\n", listName, symbNo);
                 symbolSequence += std::format(
 R"(    PNode {} = {};
     if (!{})
-        return nullptr;
-    conj{}.push_back({});
+        return {};
+    {}.push_back({});
 )",
-                symbNode, symbFunction, symbNode, conjNo, symbNode);
+                symbNode, symbFunction, symbNode, failValue, listName, symbNode);
+                if (mark)
+                    symbolSequence += std::format("    size_t {}end{} = pos;\n", listName, symbNo);
             }
         }
         symbNo++;
@@ -175,12 +419,14 @@ R"(    PNode {} = {};
     return symbolSequence;
 }
 
-// Generate code for parsing a conjunct
-static std::string parseConj(const GNode& conj, size_t conjNo, size_t ruleSize) {
+/* Generate code for parsing a conjunct, which is parsed orderNo-th of the rule's conjuncts
+ * If keepTree is false (the non-terminal has a value instead), the conjunct's nodes are not
+ * added to the tree */
+static std::string parseConj(const GNode& conj, size_t conjNo, size_t orderNo, size_t ruleSize, const std::map<std::string, StrVec>& refNames, size_t& refNo, bool keepTree, const std::set<int>& marked) {
     bool posConj = conj->isPositive();
     std::string conjCode = "";
     const SymbVec& conjSymbols = conj->getSymbols();
-    std::string symbolSequence = parseSymbSeq(conjSymbols, posConj, conjNo);
+    std::string symbolSequence = parseSymbSeq(conjSymbols, posConj, "conj" + std::to_string(conjNo), "nullptr", refNames, refNo, marked);
 
     std::string conjStr = "";
     for (const SYMBOL& symb : conjSymbols)
@@ -191,19 +437,23 @@ static std::string parseConj(const GNode& conj, size_t conjNo, size_t ruleSize)
         std::string isLastConj = "";
 
         // After last negative conjunct, move to end of substring
-        if (conjNo == ruleSize - 1)
+        if (orderNo == ruleSize - 1)
             isLastConj = "\n    pos = end;";
 
+        // Nodes of EBNF non-terminals in the conjunct are added to a list that is not kept
+        std::string ignoredList = "";
+        if (std::any_of(conjSymbols.cbegin(), conjSymbols.cend(), [](const SYMBOL& symb) {return (symb.type == NON_TERM) && (ebnfNts.count(symb.str) > 0);}))
+            ignoredList = "\n    PNodeList conj" + std::to_string(conjNo) + ";";
+
         // If negative conjunct is successfully parsed, this is a failure
         return std::format(R"(
-    pos = start;
-    bool success = ({});
-    if (success && (pos == end)) {{
+    pos = start;{}
+    if (({}) && (pos == end)) {{
         conjFail(wanted, start, end, false, "{}");
         return nullptr;
     }}{}
 )", 
-        symbolSequence, conjStr, isLastConj);
+        ignoredList, symbolSequence, conjStr, isLastConj);
     }
     
     // Positive conjunct that contains at least 1 (non-)terminal
@@ -216,12 +466,11 @@ R"(    PNodeList conj{};
 
         // Adjust code if rule contains multiple conjuncts
         if (ruleSize > 1) {
-            if (conjNo == 0)
+            if (orderNo == 0)
                 conjCode = std::format(
-R"(    start = pos;
-{}    end = pos;
+R"({}    end = pos;
 )", 
-                conjCode); // Record positions where first conjunct starts and ends
+                conjCode); // Record position where first conjunct ends
 
             /* For subsequent conjuncts, return to recorded start position before parsing
              * If parsing stops before or after recorded end position, this is a failure,
@@ -237,6 +486,8 @@ R"(    start = pos;
                 conjCode, conjStr);
         }
 
+        if (!keepTree)
+            return conjCode;
         return std::format(
 R"({}    subTreeVersions.push_back(conj{});
 
@@ -247,230 +498,2484 @@ R"({}    subTreeVersions.push_back(conj{});
     return conjCode;
 }
 
+/* Translate semantic action of a conjunct into C++: $$ is the value being computed, and $n
+ * is the value of the n-th symbol if it is a non-terminal with a type, or else the text of
+ * the tokens it matched, so its start and end are marked */
+static std::string actionCode(const GNode& conj, size_t conjNo, std::set<int>& marked) {
+    std::string action = conj->getAction();
+    const SymbVec& symbols = conj->getSymbols();
+    std::string code = "";
+    for (size_t i = 0; i < action.length(); i++) {
+        if (action.compare(i, 2, "$$") == 0) {
+            code += "value";
+            i++;
+            continue;
+        }
+        size_t end = i + 1;
+        while ((action[i] == '$') && (end < action.length()) && isdigit(action[end]))
+            end++;
+        if (end == i + 1) {
+            code += action[i];
+            continue;
+        }
+
+        int symbNo = std::stoi(action.substr(i + 1, end - i - 1)) - 1;
+        const SYMBOL& symb = symbols[symbNo];
+        if ((symb.type == NON_TERM) && (ntTypes.count(symb.str) > 0)) {
+            code += std::format("valueOf<{}>(conj{}node{})", ntTypes[symb.str], conjNo, symbNo);
+        } else {
+            code += std::format("tokenText(conj{}start{}, conj{}end{})", conjNo, symbNo, conjNo, symbNo);
+            marked.insert(symbNo);
+        }
+        i = end - 1;
+    }
+    return code;
+}
+
 static std::string parseRule(int ruleNo, const GNodeList& conjuncts) {
     std::string parseConjuncts = "";
     size_t ruleSize = conjuncts.size(); // number of conjuncts in rule
 
+    /* A non-terminal with a type has a value instead of a subtree, computed by the action
+     * of the rule's first positive conjunct; actions of other conjuncts are not run */
+    auto typeEntry = ntTypes.find(ruleNts[ruleNo]);
+    bool typed = (typeEntry != ntTypes.end());
+    size_t firstPos = 0;
+    while ((firstPos < ruleSize) && !conjuncts[firstPos]->isPositive())
+        firstPos++;
+    std::string action = "";
+    std::set<int> marked;
+    if (typed && (firstPos < ruleSize))
+        action = actionCode(conjuncts[firstPos], firstPos, marked);
+
+    /* With more than one conjunct, the first positive conjunct is parsed first, since
+     * where it ends is where the others must end; references are still numbered in the
+     * order they are written */
+    std::vector<size_t> order, refStarts;
+    size_t refCount = 0;
+    for (size_t conjNo = 0; conjNo < ruleSize; conjNo++) {
+        if (conjNo == firstPos)
+            order.insert(order.begin(), conjNo);
+        else
+            order.push_back(conjNo);
+        refStarts.push_back(refCount);
+        for (const SYMBOL& symb : conjuncts[conjNo]->getSymbols())
+            refCount += (symb.type == NON_TERM);
+    }
+    if (ruleSize > 1)
+        parseConjuncts = "    size_t start = pos, end = pos;\n";
+
     // Generate code for each conjunct
-    size_t conjNo = 0;
-    for (const GNode& conj : conjuncts) {
-        parseConjuncts += parseConj(conj, conjNo, ruleSize);
-        conjNo++;
+    for (size_t orderNo = 0; orderNo < ruleSize; orderNo++) {
+        size_t conjNo = order[orderNo];
+        size_t refNo = refStarts[conjNo]; // number of non-terminals referenced before conjunct
+        parseConjuncts += parseConj(conjuncts[conjNo], conjNo, orderNo, ruleSize, ruleRefNames[ruleNo], refNo, !typed, (conjNo == firstPos) ? marked : std::set<int>());
     }
 
+    // With fuzzing, the rule is the last to have matched when it returns, for coverage
+    std::string fuzzRuleCode = fuzzing ? "    fuzzRule = " + std::to_string(ruleNo) + ";\n" : "";
+
+    if (typed)
+        return std::format(
+R"(
+
+PNode {}(bool wanted, std::string nt) {{
+{}    {} value{{}};
+    {{{}}}
+{}    return std::make_shared<ValueNode<{}>>(nt, std::move(value));
+}})",
+        ruleNames[ruleNo], parseConjuncts, typeEntry->second, action, fuzzRuleCode, typeEntry->second);
+
     // Add conjunct code to function
     return std::format(
 R"(
 
-PNode rule{}(bool wanted, std::string nt) {{
+PNode {}(bool wanted, std::string nt) {{
     std::vector<PNodeList> subTreeVersions;
-{}    return std::make_shared<Internal>(nt, std::move(subTreeVersions));
+{}{}    return std::make_shared<Internal>(nt, std::move(subTreeVersions));
 }})", 
-    ruleNo, parseConjuncts); // if return statement is reached, parsing is successful
+    ruleNames[ruleNo], parseConjuncts, fuzzRuleCode); // if return statement is reached, parsing is successful
 }
 
-// Generate code for parsing a non-terminal
-static std::string parseNonTerminal(int nonTerminalNo, const std::string& nt) {
-    std::string ntCases = "";
-    std::string expected = "";
-    std::vector<std::string> sequences;
+//--------------------------------------//
+// Regular Non-Terminal Code Generation //
+//--------------------------------------//
 
-    // For each sequence that is paired with the non-terminal in the parse table, add a case
-    for (const auto& entry : parseTable) {
-        if ((entry.first).first == nt)
-            sequences.push_back((entry.first).second); // sequence
-    }
-    std::sort(sequences.begin(), sequences.end(), [](std::string& a, std::string& b) {
-        return a.length() > b.length();
-    }); // sort sequences in descending order of length
+/* Helper functions for non-terminals compiled to DFAs
+ * DFAs are flat tables of the next state for each state and token ID (-1 if dead)
+ * A match may only end where the next k tokens are in the non-terminal's PFOLLOW set, which
+ * is also a DFA; the longest such match is used */
+static std::string regularCode(int k, int classCount) {
+    return std::format(R"(
 
-    int caseNo = 0;
-    for (std::string s : sequences) {
-        int ruleNo = parseTable[make_pair(nt, s)];
-        std::string elseStr = "";
-        if (caseNo > 0)
-            elseStr = "} else ";
+bool followsAt(size_t i, const int *followNext, const bool *followAccept) {{
+    int state = 0;
+    for (size_t j = i; (j < sentence.size()) && (j < i + {}); j++) {{
+        state = followNext[state * {} + sentence[j].id];
+        if (state < 0)
+            return false;
+    }}
+    return followAccept[state];
+}}
+
+long matchRegular(const int *next, const bool *accept, const int *followNext, const bool *followAccept) {{
+    long matchEnd = -1;
+    int state = 0;
+    size_t i = pos;
+    while (true) {{
+        if (accept[state] && followsAt(i, followNext, followAccept))
+            matchEnd = i;
+        if (i == sentence.size())
+            return matchEnd;
+        state = next[state * {} + sentence[i].id];
+        if (state < 0)
+            return matchEnd;
+        i++;
+    }}
+}})",
+    k, classCount, classCount);
+}
 
-        // Add code for which rule to use in this case
-        ntCases += std::format(
-R"(
-        {}if (startsWith(nextKTokens, "{}")) {{
-            newNode = rule{}(wanted, "{}");
-)", 
-        elseStr, s, ruleNo, nt);
+/* Generate DFA as static tables: transitions (one row per state) and accepting states
+ * Dead states other than the start state are left out, and become -1 */
+static std::string dfaTables(const TokenDfa& dfa, const std::string& name) {
+    std::vector<int> stateNos;
+    int stateCount = 0;
+    for (size_t state = 0; state < dfa.accept.size(); state++) {
+        bool dead = (state > 0) && !dfa.accept[state] && std::all_of((dfa.next[state]).cbegin(), (dfa.next[state]).cend(), [&](int next) {
+            return next == (int)state;
+        });
+        stateNos.push_back(dead ? -1 : stateCount++);
+    }
 
-        // Add sequence to list of expected sequences
-        std::string displayS = (s == "") ? "EOF" : s;
-        expected = (expected == "") ? expected += displayS : expected += ", " + displayS;
-        caseNo++;
+    std::string nextStr = "", acceptStr = "";
+    for (size_t state = 0; state < dfa.accept.size(); state++) {
+        if (stateNos[state] < 0)
+            continue;
+        nextStr += (nextStr == "") ? "\n        " : ",\n        ";
+        for (size_t id = 0; id < (dfa.next[state]).size(); id++)
+            nextStr += ((id > 0) ? ", " : "") + std::to_string(stateNos[dfa.next[state][id]]);
+        acceptStr += (acceptStr == "") ? "" : ", ";
+        acceptStr += dfa.accept[state] ? "true" : "false";
     }
+    return std::format("    static const int {}Next[] = {{{}}};\n    static const bool {}Accept[] = {{{}}};\n",
+        name, nextStr, name, acceptStr);
+}
 
-    // Add cases to the non-terminal's numbered function
+/* Generate batch recogniser, for a start symbol compiled to a DFA over single-character
+ * terminals
+ * The DFA is turned into a table over bytes, with a dead state for bytes that are not
+ * terminals, and a last column for the end of an input, which keeps the state
+ * Inputs are run batchLanes at a time, one per lane, interleaved so that the loop over
+ * lanes is a gather from the table that compilers can vectorise; lanes whose inputs have
+ * ended read the last column, until the longest input in the batch ends */
+static std::string batchRecogniser(const std::string& startSymbol, int classCount) {
     return std::format(R"(
 
-PNode nonTerminal{}(bool wanted) {{
-    std::pair<std::string, size_t> memoIndex = std::make_pair("{}", pos);
+#include <cstdint>
 
-    if (memo.count(memoIndex) == 0) {{
-        std::string nextKTokens = nextK();
-        PNode newNode;
-{}
-        }} else {{
-            tokenFail(wanted, nextKTokens, "{}");
-            newNode = nullptr;
+const int batchLanes = 32;
+std::vector<int> batchNext; // next state, for each state and byte (or end of input)
+std::vector<bool> batchAccept;
+
+void initBatch(const std::map<std::string, int>& terminals) {{
+{}    int stateCount = sizeof(startAccept) / sizeof(bool);
+    int dead = stateCount;
+    std::vector<int> byteIds(256, -1);
+    for (const auto& term : terminals)
+        byteIds[(unsigned char)term.first[0]] = term.second;
+
+    batchNext.assign((stateCount + 1) * 257, dead);
+    for (int state = 0; state < stateCount; state++) {{
+        for (int c = 0; c < 256; c++) {{
+            if ((byteIds[c] >= 0) && (startNext[state * {} + byteIds[c]] >= 0))
+                batchNext[state * 257 + c] = startNext[state * {} + byteIds[c]];
+        }}
+        batchNext[state * 257 + 256] = state;
+    }}
+    batchAccept.assign(startAccept, startAccept + stateCount);
+    batchAccept.push_back(false);
+}}
+
+// Set bit i of verdicts if input i is in the language
+void recognizeBatch(const std::vector<std::string>& inputs, std::vector<uint64_t>& verdicts) {{
+    verdicts.assign((inputs.size() + 63) / 64, 0);
+    std::vector<unsigned short> block; // byte of each lane at each position
+    for (size_t first = 0; first < inputs.size(); first += batchLanes) {{
+        size_t lanes = (inputs.size() - first < batchLanes) ? inputs.size() - first : batchLanes;
+        size_t longest = 0;
+        for (size_t lane = 0; lane < lanes; lane++)
+            longest = (longest > inputs[first + lane].length()) ? longest : inputs[first + lane].length();
+
+        block.assign(longest * batchLanes, 256);
+        for (size_t lane = 0; lane < lanes; lane++) {{
+            const std::string& input = inputs[first + lane];
+            for (size_t i = 0; i < input.length(); i++)
+                block[i * batchLanes + lane] = (unsigned char)input[i];
         }}
 
-        if (!newNode) {{
-            memo[memoIndex] = nullptr;
-            return nullptr;
+        int state[batchLanes] = {{}};
+        for (size_t i = 0; i < longest; i++) {{
+            const unsigned short *bytes = &block[i * batchLanes];
+            for (int lane = 0; lane < batchLanes; lane++)
+                state[lane] = batchNext[state[lane] * 257 + bytes[lane]];
+        }}
+        for (size_t lane = 0; lane < lanes; lane++) {{
+            if (batchAccept[state[lane]])
+                verdicts[(first + lane) / 64] |= (uint64_t)1 << ((first + lane) % 64);
         }}
-        memo[memoIndex] = newNode;
-        return newNode;
     }}
+}}
+
+// Recognise each line of the input file, and print its verdict (1 if in the language)
+int recognizeFile(const std::map<std::string, int>& terminals) {{
+    std::string input = "";
+    char buffer[65536];
+    size_t readCount;
+    while ((readCount = fread(buffer, 1, sizeof(buffer), inputFile)) > 0)
+        input.append(buffer, readCount);
+    fclose(inputFile);
 
-    if (!memo[memoIndex])
-        return nullptr;
-    return memo[memoIndex];
-}})", 
-    nonTerminalNo, nt, ntCases, expected); // if function does not return after any case, parsing fails
-}
+    std::vector<std::string> inputs;
+    size_t lineStart = 0;
+    while (lineStart < input.length()) {{
+        size_t lineEnd = input.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+            lineEnd = input.length();
+        size_t textEnd = ((lineEnd > lineStart) && (input[lineEnd - 1] == '\r')) ? lineEnd - 1 : lineEnd;
+        inputs.push_back(input.substr(lineStart, textEnd - lineStart));
+        lineStart = lineEnd + 1;
+    }}
 
-/* Main parser function
- * Lexer: reads characters from input file and converts them to tokens
- * Calls the parsing function for the start symbol (the last numbered non-terminal)
- * Parser must stop at the end of the input for parsing to succeed
- * If parsing succeeds, print parse tree */
-static std::string mainFunction(int nonTerminalNo, std::string terminalSet) {
-    return std::format(R"(
+    initBatch(terminals);
+    std::vector<uint64_t> verdicts;
+    recognizeBatch(inputs, verdicts);
 
-int main(int argc, char **argv) {{
-    if (argc == 2) {{
-        inputFile = fopen(argv[1], "r");
-        if (inputFile == NULL)
-            std::cout << "Error opening file\n";
-    }} else {{
-        std::cout << "Usage: ./parser <input file>\n";
-        return 1;
+    std::string result = "";
+    size_t accepted = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {{
+        bool verdict = (verdicts[i / 64] >> (i % 64)) & 1;
+        result += verdict ? '1' : '0';
+        accepted += verdict;
     }}
+    std::cout << result + "\n" + std::to_string(accepted) + " of " + std::to_string(inputs.size()) + " inputs accepted\n";
+    return 0;
+}})",
+    dfaTables(regularDfas[startSymbol], "start"), classCount, classCount);
+}
 
-    std::set<std::string> terminals = {};
-    
-    int maxTermLen = 0;
-    for (std::string str : terminals)
-        maxTermLen = (maxTermLen > str.length()) ? maxTermLen : str.length();
+/* Code writing a parse tree in succinct form: the tree as balanced parentheses (an open
+ * bit where a node starts and a close bit where it ends, in preorder), then each node's
+ * label packed into as few bits as the number of distinct labels needs
+ * Given the shared nodes of the tree, each is written once, and later uses are reference
+ * nodes giving the number of the node they refer to
+ * succinct_tree.h describes the file layout, and reads and navigates the tree */
+static std::string succinctCode = R"(
+
+#include <cstdint>
+
+class SuccinctWriter: public TreeWalker {
+    std::vector<uint64_t> parens;
+    size_t parenCount = 0;
+    std::vector<uint32_t> nodeLabels;
+    std::map<std::pair<int, std::string>, uint32_t> labelNos;
+    std::vector<std::pair<int, std::string>> labels; // kind (non-terminal, conjunct, terminal or reference) and text
+
+    std::set<const ParseNode*> shared;
+    std::map<const ParseNode*, uint64_t> sharedNos;             // number of each shared node written
+    std::vector<std::pair<uint64_t, uint64_t>> references;      // number of each reference node, and of the node it refers to
+
+    void addParen(bool open) {
+        if (parenCount % 64 == 0)
+            parens.push_back(0);
+        if (open)
+            parens.back() |= (uint64_t)1 << (parenCount % 64);
+        parenCount++;
+    }
 
-    std::string currentStr = "";
-    int lineNo = 1;
-    int columnNo = 1;
-    int maxMatchLen = 0;
-    char currentChar = fgetc(inputFile);
-    while (currentChar != EOF) {{
-        bool newLine = false;
-        if ((currentChar == '\n') || (currentChar == '\r')) {{
-            char nextChar;
-            if ((nextChar = fgetc(inputFile)) != EOF)
-                currentStr += currentChar;
-            currentChar = nextChar;
-            newLine = true;
-        }} else {{
-            currentStr += currentChar;
-            currentChar = fgetc(inputFile);
-        }}
+    void addNode(int kind, const std::string& text) {
+        auto labelNo = labelNos.emplace(std::make_pair(kind, text), labels.size());
+        if (labelNo.second)
+            labels.push_back(std::make_pair(kind, text));
+        nodeLabels.push_back(labelNo.first->second);
+        addParen(true);
+    }
 
-        if (terminals.count(currentStr) > 0)
-            maxMatchLen = currentStr.length();
+    public:
+        SuccinctWriter(std::set<const ParseNode*> s = {}): shared(std::move(s)) {}
 
-        if (currentStr.length() == maxTermLen) {{
-            if (maxMatchLen == 0) {{
-                std::cout << "Lexer error [ln " + std::to_string(lineNo) + ", col " + std::to_string(columnNo - currentStr.length() + 1) + "]: unrecognised sequence '" + currentStr + "'\n";
-                return 1;
-            }}
+        bool enter(const ParseNode *node) override {
+            if (shared.count(node) == 0)
+                return true;
 
-            std::string tokenStr = currentStr.substr(0, maxMatchLen);
-            sentence.push_back(makeToken(tokenStr, lineNo, columnNo));
-            currentStr.erase(0, maxMatchLen);
-            maxMatchLen = 0;
-        }}
+            auto sharedNo = sharedNos.find(node);
+            if (sharedNo == sharedNos.end()) {
+                sharedNos[node] = nodeLabels.size(); // its node comes next
+                return true;
+            }
+            references.push_back(std::make_pair(nodeLabels.size(), sharedNo->second));
+            addNode(3, "");
+            addParen(false);
+            return false;
+        }
+        void enterNonTerminal(const std::string& symbol) override {
+            addNode(0, symbol);
+        }
+        void enterConjunct() override {
+            addNode(1, "");
+        }
+        void leave() override {
+            addParen(false);
+        }
+        void terminal(const TOKEN& token) override {
+            addNode(2, token.str);
+            addParen(false);
+        }
+        void value(const std::string& symbol, const std::string& value) override {
+            addNode(0, symbol + " = " + value);
+            addParen(false);
+        }
 
-        columnNo++;
-        if (newLine) {{
-            lineNo++;
-            columnNo = 1;
-        }}
-    }}
-    fclose(inputFile);
+        bool write(const std::string& fileName) {
+            FILE *file = fopen(fileName.c_str(), "wb");
+            if (file == NULL)
+                return false;
+
+            uint8_t labelBits = 1;
+            while (((uint64_t)1 << labelBits) < labels.size())
+                labelBits++;
+            std::vector<uint64_t> packed((nodeLabels.size() * labelBits + 63) / 64, 0);
+            for (size_t node = 0; node < nodeLabels.size(); node++) {
+                size_t bit = node * labelBits;
+                packed[bit / 64] |= (uint64_t)nodeLabels[node] << (bit % 64);
+                if (bit % 64 + labelBits > 64)
+                    packed[bit / 64 + 1] |= (uint64_t)nodeLabels[node] >> (64 - bit % 64);
+            }
 
-    if (sentence.empty()) {{
-        std::cout << "File is empty\n";
-        return 1;
-    }}
+            uint64_t nodeCount = nodeLabels.size();
+            uint32_t labelCount = labels.size();
+            fwrite("BPT2", 1, 4, file);
+            fwrite(&nodeCount, sizeof(nodeCount), 1, file);
+            fwrite(&labelCount, sizeof(labelCount), 1, file);
+            for (const auto& label : labels) {
+                uint8_t kind = label.first;
+                uint32_t length = label.second.length();
+                fwrite(&kind, sizeof(kind), 1, file);
+                fwrite(&length, sizeof(length), 1, file);
+                fwrite(label.second.data(), 1, length, file);
+            }
+            fwrite(&labelBits, sizeof(labelBits), 1, file);
+            fwrite(parens.data(), sizeof(uint64_t), parens.size(), file);
+            fwrite(packed.data(), sizeof(uint64_t), packed.size(), file);
+            uint64_t referenceCount = references.size();
+            fwrite(&referenceCount, sizeof(referenceCount), 1, file);
+            fwrite(references.data(), sizeof(uint64_t), 2 * references.size(), file);
+            return fclose(file) == 0;
+        }
+};)";
+
+/* Code exporting a parse tree as JSON or S-expressions, streamed into a large buffer that
+ * is written to the file when full
+ * The start of each non-terminal's node is escaped once and kept; terminal text is escaped
+ * 8 bytes at a time, copying whole words that hold no character needing an escape
+ * Given the shared nodes of the tree, each is written once with an ID, and later uses
+ * refer to it: {"ref": n} in JSON, and #n# (for #n=) in S-expressions */
+static std::string exportCode = R"(
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+class TreeExporter: public TreeWalker {
+    static const size_t bufferSize = 1 << 20;
+
+    FILE *file;
+    bool json;
+    std::vector<char> buffer;
+    size_t used = 0;
+    bool failed = false;
+
+    std::unordered_map<std::string, std::string> starts; // start of node of each non-terminal, escaped
+    std::vector<bool> closesNonTerminal;                  // for each node entered, whether it is a non-terminal
+    bool afterItem = false;                               // whether a separator is needed before the next item
+
+    std::set<const ParseNode*> shared;
+    std::map<const ParseNode*, size_t> ids;
+    size_t currentId = 0; // ID of node entered, if shared and not yet written
+
+    void flush() {
+        if ((used > 0) && (fwrite(buffer.data(), 1, used, file) != used))
+            failed = true;
+        used = 0;
+    }
 
-    pos = 0;
-    PNode root = nonTerminal{}(true);
-    if (root) {{
-        if (pos == sentence.size()) {{
-            std::cout << "Parsing successful\n";
-            std::cout << root->toString(0);
-            return 0;
-        }}
+    // Make room for n more characters
+    char *room(size_t n) {
+        if (used + n > bufferSize)
+            flush();
+        return buffer.data() + used;
+    }
 
-        std::cout << "Parser error" + displayPos(sentence[pos].lineNo, sentence[pos].columnNo) + ": parsing terminated before end of input\n";
-    }}
+    void put(const char *text, size_t length) {
+        if (length > bufferSize) {
+            flush();
+            failed |= (fwrite(text, 1, length, file) != length);
+            return;
+        }
+        memcpy(room(length), text, length);
+        used += length;
+    }
 
-    std::cout << "Parsing failed\n";
-    return 1;
-}})", 
-    terminalSet, nonTerminalNo);
-}
+    void put(const std::string& text) {
+        put(text.data(), text.length());
+    }
 
-// Write code to file
-void RDCodegen(StrVec ntOrder, int k) {
-    std::ofstream parserFile;
-    parserFile.open("parser.cpp");
-    parserFile << beginningCode;
+    void put(char c) {
+        *room(1) = c;
+        used++;
+    }
 
-    // Function for obtaining sequence of next k tokens
-    parserFile << std::format(R"(
+    void putNumber(size_t n) {
+        char *out = room(20);
+        used += std::to_chars(out, out + 20, n).ptr - out;
+    }
 
-std::string nextK() {{
-    std::string sequence = "";
-    int i = pos;
-    while ((i < sentence.size()) && (i < pos + {})) {{
-        sequence += sentence[i].str;
-        i++;
-    }}
-    return sequence;
-}})",
-    k);
+    // Whether any of the 8 bytes of word is a control character, '"' or '\\'
+    static bool needsEscape(uint64_t word) {
+        const uint64_t ones = 0x0101010101010101, highs = 0x8080808080808080;
+        uint64_t quotes = word ^ (ones * '"'), backslashes = word ^ (ones * '\\');
+        uint64_t found = (word - ones * 0x20) & ~word; // bytes below 0x20
+        found |= (quotes - ones) & ~quotes;
+        found |= (backslashes - ones) & ~backslashes;
+        return (found & highs) != 0;
+    }
 
-    // Build string representing set of terminals
-    std::string terminalSet = "{";
-    int terminalNo = 0;
-    for (const std::string& s : alphabet) {
-        if (terminalNo > 0)
-            terminalSet += ", ";
-        terminalSet += "\"" + s + "\"";
-        terminalNo++;
+    void putEscaped(char c) {
+        if ((c == '"') || (c == '\\')) {
+            put('\\');
+            put(c);
+        } else if (json && ((unsigned char)c < 0x20)) {
+            const char *hex = "0123456789abcdef";
+            char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+            put(escape, 6);
+        } else {
+            put(c);
+        }
     }
-    terminalSet += "}";
 
-    /* Assign numbers to non-terminals
-     * Write forward declarations for non-terminal functions, so they can be called by
-     * rule functions */
-    int nonTerminalNo = 0;
-    parserFile << "\n";
-    for (const std::string& nt : ntOrder) {
-        nonTerminalNos[nt] = nonTerminalNo;
-        parserFile << "\nPNode nonTerminal" + std::to_string(nonTerminalNo) + "(bool wanted);";
-        nonTerminalNo++;
+    void putString(const std::string& text) {
+        put('"');
+        size_t i = 0;
+        while (i + 8 <= text.length()) {
+            uint64_t word;
+            memcpy(&word, text.data() + i, 8);
+            if (!needsEscape(word)) {
+                memcpy(room(8), &word, 8);
+                used += 8;
+            } else {
+                for (size_t j = i; j < i + 8; j++)
+                    putEscaped(text[j]);
+            }
+            i += 8;
+        }
+        for (; i < text.length(); i++)
+            putEscaped(text[i]);
+        put('"');
+    }
+
+    // Start a node, with its ID if it is shared; open is false for an S-expression atom
+    void startNode(bool open) {
+        if (afterItem)
+            put(json ? ',' : ' ');
+        afterItem = false;
+        if (json) {
+            put('{');
+            if (currentId > 0) {
+                put("\"id\":", 5);
+                putNumber(currentId);
+                put(',');
+            }
+        } else {
+            if (currentId > 0) {
+                put('#');
+                putNumber(currentId);
+                put('=');
+            }
+            if (open)
+                put('(');
+        }
+        currentId = 0;
+    }
+
+    public:
+        TreeExporter(FILE *f, bool j, std::set<const ParseNode*> s = {}): file(f), json(j), buffer(bufferSize), shared(std::move(s)) {}
+
+        bool enter(const ParseNode *node) override {
+            currentId = 0;
+            if (shared.count(node) == 0)
+                return true;
+
+            auto id = ids.find(node);
+            if (id == ids.end()) {
+                currentId = ids.size() + 1;
+                ids[node] = currentId;
+                return true;
+            }
+            if (afterItem)
+                put(json ? ',' : ' ');
+            put(json ? "{\"ref\":" : "#", json ? 7 : 1);
+            putNumber(id->second);
+            put(json ? '}' : '#');
+            afterItem = true;
+            return false;
+        }
+        void enterNonTerminal(const std::string& symbol) override {
+            startNode(true);
+            auto start = starts.find(symbol);
+            if (start != starts.end()) {
+                put(start->second);
+            } else {
+                room(6 * symbol.length() + 32); // so it is not flushed while being written
+                size_t from = used;
+                if (json) {
+                    put("\"nonTerminal\":", 14);
+                    putString(symbol);
+                    put(",\"conjuncts\":[", 14);
+                } else {
+                    put(symbol);
+                }
+                starts.emplace(symbol, std::string(buffer.data() + from, used - from));
+            }
+            closesNonTerminal.push_back(true);
+            afterItem = !json; // S-expression conjuncts follow the name
+        }
+        void enterConjunct() override {
+            if (afterItem)
+                put(json ? ',' : ' ');
+            put(json ? '[' : '(');
+            closesNonTerminal.push_back(false);
+            afterItem = false;
+        }
+        void leave() override {
+            put(json ? ']' : ')');
+            if (json && closesNonTerminal.back())
+                put('}');
+            closesNonTerminal.pop_back();
+            afterItem = true;
+        }
+        void terminal(const TOKEN& token) override {
+            startNode(false);
+            if (json)
+                put("\"terminal\":", 11);
+            putString(token.str);
+            if (json) {
+                put(",\"line\":", 8);
+                putNumber(token.lineNo);
+                put(",\"column\":", 10);
+                putNumber(token.columnNo);
+                put('}');
+            }
+            afterItem = true;
+        }
+        void value(const std::string& symbol, const std::string& value) override {
+            startNode(true);
+            if (json) {
+                put("\"nonTerminal\":", 14);
+                putString(symbol);
+                put(",\"value\":", 9);
+            } else {
+                put(symbol);
+                put(" = ", 3);
+            }
+            putString(value);
+            put(json ? '}' : ')');
+            afterItem = true;
+        }
+
+        // Write what is left in the buffer; returns false if writing failed
+        bool finish() {
+            put('\n');
+            flush();
+            return !failed;
+        }
+};)";
+
+/* Code writing subtrees to an arena of bytes and rebuilding them from it, used to keep memo
+ * entries outside the process's tree
+ * Values of non-terminals with types cannot be rebuilt, so a subtree holding one is not
+ * given an offset */
+static std::string arenaCode = R"(
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+const uint64_t noNode = UINT64_MAX;
+
+/* Reads values from data of the given length; reading past the end sets failed and gives
+ * zeros, so that damaged data is rejected rather than read out of bounds */
+struct ArenaReader {
+    const char *data;
+    uint64_t length;
+    uint64_t at = 0;
+    bool failed = false;
+
+    template <typename T>
+    T read() {
+        T value{};
+        if (length - at < sizeof(T))
+            failed = true;
+        else
+            memcpy(&value, data + at, sizeof(T));
+        at += failed ? 0 : sizeof(T);
+        return value;
+    }
+
+    // Skip the next count bytes, returning where they start (nullptr if there are fewer)
+    const char *skip(uint64_t count) {
+        if (length - at < count) {
+            failed = true;
+            return nullptr;
+        }
+        at += count;
+        return data + at - count;
+    }
+};
+
+/* Writes subtrees to the arena as records in preorder: 'N' and a symbol number starts a
+ * non-terminal, 'C' a conjunct, 'n' and 'c' end them, 'T' and the token's ID, line,
+ * column, length and text is a terminal, and 'R' and an offset refers to a subtree
+ * written before
+ * A subtree moved to the spill arena is referred to there; written elsewhere, it is rebuilt
+ * and written once, and its rebuilt nodes are not given offsets, as they are freed after
+ * being written and their addresses may be reused */
+class ArenaWriter: public TreeWalker {
+    struct Open {
+        const ParseNode *node;
+        uint64_t offset;
+        bool nonTerminal;
+        bool restorable; // false if it holds a value
+    };
+
+    std::vector<Open> open;
+    const ParseNode *entered = nullptr;
+
+    template <typename T>
+    void write(T value) {
+        records.append((const char *)&value, sizeof(T));
     }
 
-    // Write parser functions for rules and non-terminals
-    for (const auto& ruleEntry : rules)
-        parserFile << parseRule(ruleEntry.first, ruleEntry.second);
-    for (const std::string& nt : ntOrder)
-        parserFile << parseNonTerminal(nonTerminalNos[nt], nt);
+    void close(bool restorable) {
+        if (open.empty())
+            entryRestorable &= restorable;
+        else
+            open.back().restorable &= restorable;
+    }
 
-    parserFile << mainFunction(nonTerminalNo - 1, terminalSet); // write main function
-    parserFile.close();
+    public:
+        std::string records = "";
+        uint64_t base;                                // offset of records in arena
+        std::map<const ParseNode*, uint64_t>& offsets; // offset of each non-terminal node written
+        std::map<std::string, uint64_t>& symbolNos;
+        bool entryRestorable = true;
+        bool spillArena = false;                     // whether records are appended to the spill arena
+        std::map<uint64_t, uint64_t> spilledOffsets; // offset each spilled subtree is written at
+        int rebuilding = 0;                          // number of rebuilt subtrees being written
+
+        ArenaWriter(uint64_t b, std::map<const ParseNode*, uint64_t>& o, std::map<std::string, uint64_t>& s): base(b), offsets(o), symbolNos(s) {}
+
+        bool enter(const ParseNode *node) override {
+            auto offset = offsets.find(node);
+            if (offset == offsets.end()) {
+                entered = node;
+                return true;
+            }
+            write('R');
+            write(offset->second);
+            return false;
+        }
+        void enterNonTerminal(const std::string& symbol) override {
+            open.push_back({entered, base + records.length(), true, true});
+            write('N');
+            write(symbolNos.emplace(symbol, symbolNos.size()).first->second);
+        }
+        void enterConjunct() override {
+            open.push_back({nullptr, 0, false, true});
+            write('C');
+        }
+        void leave() override {
+            Open node = open.back();
+            open.pop_back();
+            write(node.nonTerminal ? 'n' : 'c');
+            if (node.nonTerminal && node.restorable && (rebuilding == 0))
+                offsets[node.node] = node.offset;
+            close(node.restorable);
+        }
+        void terminal(const TOKEN& token) override {
+            write('T');
+            write(token.id);
+            write(token.lineNo);
+            write(token.columnNo);
+            write((uint32_t)token.str.length());
+            records += token.str;
+        }
+        void value(const std::string& symbol, const std::string& value) override {
+            close(false);
+        }
+        bool enterSpilled(uint64_t offset) override {
+            auto written = spilledOffsets.find(offset);
+            if (spillArena || (written != spilledOffsets.end())) {
+                write('R');
+                write(spillArena ? offset : written->second);
+                return false;
+            }
+            spilledOffsets[offset] = base + records.length();
+            rebuilding++;
+            return true;
+        }
+        void leaveSpilled() override {
+            rebuilding--;
+        }
+};
+
+/* Rebuild subtree written at offset in arena of the given length; each non-terminal rebuilt
+ * is kept in cache, if given, so that references to it share it, and a reference is given
+ * by stub instead, if given, so that it is only rebuilt when needed
+ * Returns nullptr if the records are damaged: reading past the end of the arena, unknown
+ * records or symbols, records outside a node, and references to anything but a subtree
+ * written before (which could loop) */
+PNode restoreNode(const char *arena, uint64_t length, uint64_t offset, const std::vector<std::string>& symbols, std::unordered_map<uint64_t, PNode> *cache, PNode (*stub)(uint64_t) = nullptr) {
+    struct Frame {
+        uint64_t offset;
+        uint64_t symbolNo;
+        std::vector<PNodeList> children;
+    };
+    std::vector<Frame> frames;
+    if (offset > length)
+        return nullptr;
+    ArenaReader reader = {arena, length, offset};
+    while (true) {
+        uint64_t start = reader.at;
+        char kind = reader.read<char>();
+        PNode node;
+        if (kind == 'N') {
+            uint64_t symbolNo = reader.read<uint64_t>();
+            if (reader.failed || (symbolNo >= symbols.size()))
+                return nullptr;
+            frames.push_back({start, symbolNo, {}});
+            continue;
+        } else if ((kind == 'C') && !frames.empty()) {
+            frames.back().children.emplace_back();
+            continue;
+        } else if ((kind == 'c') && !frames.empty()) {
+            continue;
+        } else if ((kind == 'n') && !frames.empty()) {
+            node = std::make_shared<Internal>(symbols[frames.back().symbolNo], std::move(frames.back().children));
+            if (cache != nullptr)
+                (*cache)[frames.back().offset] = node;
+            frames.pop_back();
+        } else if (kind == 'T') {
+            TOKEN token;
+            token.id = reader.read<int>();
+            token.lineNo = reader.read<int>();
+            token.columnNo = reader.read<int>();
+            uint32_t textLength = reader.read<uint32_t>();
+            const char *text = reader.skip(textLength);
+            if (reader.failed)
+                return nullptr;
+            token.str.assign(text, textLength);
+            node = std::make_shared<Leaf>(token);
+        } else if (kind == 'R') {
+            uint64_t target = reader.read<uint64_t>();
+            if (reader.failed || (target >= start))
+                return nullptr;
+            if (stub != nullptr)
+                node = stub(target);
+            else if ((cache != nullptr) && (cache->count(target) > 0))
+                node = (*cache)[target];
+            else if ((node = restoreNode(arena, length, target, symbols, cache)) == nullptr)
+                return nullptr;
+        } else {
+            return nullptr;
+        }
+
+        if (frames.empty())
+            return node;
+        if (frames.back().children.empty())
+            return nullptr;
+        frames.back().children.back().push_back(node);
+    }
+})";
+
+/* Code keeping at most memoLimit memo entries in memory: when there are more, the entries of
+ * the oldest half of positions are spilled to disk, each as its position, non-terminal and
+ * end, and the offset of its node in an arena file holding spilled subtrees
+ * Each spill appends a run of entries sorted by position and non-terminal, and a miss in
+ * memory looks for the entry in the runs covering its position, through memory maps of
+ * the files, so pages are only read back when needed; a node found is rebuilt from the
+ * arena and put back in memory
+ * A subtree already in the arena is written as a reference to it; the nodes of entries
+ * still in memory keep their offsets, so a later spill can refer to them
+ * The children of a spilled node are replaced by stubs holding their offsets, so the tree
+ * being built does not keep spilled subtrees in memory; a stub rebuilds its subtree each
+ * time it is walked, with the subtrees it refers to as stubs in turn, and there is one stub
+ * for each offset while it is in use, so it is shared as its subtree was
+ * An entry whose node cannot be rebuilt is dropped instead, and parsed again if needed */
+static std::string memoSpillCode = R"(
+
+#include <algorithm>
+#include <sys/mman.h>
+
+// Subtree spilled to the arena, rebuilt from it each time it is needed
+class SpilledNode: public ParseNode {
+    uint64_t offset;
+
+    public:
+        SpilledNode(uint64_t o): offset(o) {}
+        PNode restore() const;
+        std::string toString(int depth) override {
+            return restore()->toString(depth);
+        }
+        void walk(TreeWalker& walker) override {
+            if (walker.enterSpilled(offset)) {
+                restore()->walk(walker);
+                walker.leaveSpilled();
+            }
+        }
+};
+
+struct SpilledEntry {
+    uint64_t pos;
+    uint64_t symbolNo;
+    uint64_t end;
+    uint64_t nodeOffset; // offset of node in arena, or noNode for a failure
+};
+
+bool operator<(const SpilledEntry& a, const SpilledEntry& b) {
+    return (a.pos < b.pos) || ((a.pos == b.pos) && (a.symbolNo < b.symbolNo));
+}
+
+// Temporary file that is only appended to, and mapped into memory for reading
+struct SpillFile {
+    FILE *file = nullptr;
+    uint64_t size = 0;
+    char *map = nullptr;
+    size_t mapped = 0;
+
+    void append(const void *data, size_t length) {
+        if (file == nullptr)
+            file = tmpfile();
+        if ((file == nullptr) || (fwrite(data, 1, length, file) != length)) {
+            std::cout << "Error spilling memo to disk\n";
+            exit(1);
+        }
+        size += length;
+    }
+
+    void remap() {
+        if (mapped > 0)
+            munmap(map, mapped);
+        fflush(file);
+        map = (char *)mmap(nullptr, size, PROT_READ, MAP_SHARED, fileno(file), 0);
+        if (map == MAP_FAILED) {
+            std::cout << "Error mapping spilled memo\n";
+            exit(1);
+        }
+        mapped = size;
+    }
+};
+
+class MemoSpill {
+    struct Run {
+        size_t first, count;   // entries in entry file
+        size_t minPos, maxPos;
+    };
+
+    SpillFile entries, arena;
+    std::vector<Run> runs;
+    std::map<std::string, uint64_t> symbolNos;
+    std::vector<std::string> symbols;
+    std::map<const ParseNode*, uint64_t> offsets; // arena offset of nodes of entries in memory
+    std::map<uint64_t, std::weak_ptr<ParseNode>> stubs; // stub of each offset in use
+
+    public:
+        // Stub for subtree at offset, shared with any other in use
+        PNode stub(uint64_t offset) {
+            PNode node = stubs[offset].lock();
+            if (!node) {
+                node = std::make_shared<SpilledNode>(offset);
+                stubs[offset] = node;
+            }
+            return node;
+        }
+
+        // Rebuild subtree at offset, with the subtrees it refers to as stubs
+        PNode restore(uint64_t offset);
+
+        // Move entries of oldest half of positions in memo to disk
+        void spill() {
+            ArenaWriter writer(arena.size, offsets, symbolNos);
+            writer.spillArena = true;
+            std::vector<SpilledEntry> run;
+            std::vector<PNode> spilledNodes;
+            auto entry = memo.begin();
+            size_t minPos = entry->first.first, maxPos = minPos;
+            for (size_t entryNo = 0; entryNo < memo.size() / 2; entryNo++, entry++) {
+                maxPos = entry->first.first;
+                uint64_t nodeOffset = noNode;
+                if (entry->second.node) {
+                    auto offset = offsets.find(entry->second.node.get());
+                    if (offset == offsets.end()) {
+                        writer.entryRestorable = true;
+                        walkTree(entry->second.node, writer);
+                        offset = offsets.find(entry->second.node.get());
+                    }
+                    if (offset == offsets.end())
+                        continue; // holds a value
+                    nodeOffset = offset->second;
+                    spilledNodes.push_back(entry->second.node);
+                }
+                uint64_t symbolNo = symbolNos.emplace(entry->first.second, symbolNos.size()).first->second;
+                run.push_back({entry->first.first, symbolNo, entry->second.end, nodeOffset});
+            }
+            memo.erase(memo.begin(), entry);
+
+            symbols.resize(symbolNos.size());
+            for (const auto& symbol : symbolNos)
+                symbols[symbol.second] = symbol.first;
+            std::sort(run.begin(), run.end());
+            if (!run.empty()) {
+                runs.push_back({entries.size / sizeof(SpilledEntry), run.size(), minPos, maxPos});
+                entries.append(run.data(), run.size() * sizeof(SpilledEntry));
+                entries.remap();
+            }
+            if (writer.records != "") {
+                arena.append(writer.records.data(), writer.records.length());
+                arena.remap();
+            }
+
+            // Replace children of spilled nodes that were written with stubs, freeing them if unused
+            for (const PNode& node : spilledNodes) {
+                Internal *internal = dynamic_cast<Internal *>(node.get());
+                if (internal == nullptr)
+                    continue;
+                std::vector<PNodeList> children = internal->children();
+                for (PNodeList& conjNodes : children) {
+                    for (PNode& child : conjNodes) {
+                        auto offset = offsets.find(child.get());
+                        if (offset != offsets.end())
+                            child = stub(offset->second);
+                    }
+                }
+                internal->replaceChildren(std::move(children));
+            }
+            spilledNodes.clear();
+            for (auto stub = stubs.begin(); stub != stubs.end(); )
+                stub = stub->second.expired() ? stubs.erase(stub) : std::next(stub);
+
+            // Only offsets of nodes still held by memo are kept, as other nodes may be freed
+            std::map<const ParseNode*, uint64_t> kept;
+            for (const auto& memoEntry : memo) {
+                auto offset = offsets.find(memoEntry.second.node.get());
+                if (offset != offsets.end())
+                    kept.insert(*offset);
+            }
+            offsets = std::move(kept);
+        }
+
+        // Find spilled entry, newest first; returns false if there is none
+        bool find(const std::pair<size_t, std::string>& index, MemoEntry& found) {
+            auto symbolNo = symbolNos.find(index.second);
+            if (symbolNo == symbolNos.end())
+                return false;
+
+            SpilledEntry key = {index.first, symbolNo->second, 0, 0};
+            const SpilledEntry *all = (const SpilledEntry *)entries.map;
+            for (auto run = runs.crbegin(); run != runs.crend(); run++) {
+                if ((index.first < run->minPos) || (index.first > run->maxPos))
+                    continue;
+                const SpilledEntry *entry = std::lower_bound(all + run->first, all + run->first + run->count, key);
+                if ((entry == all + run->first + run->count) || (entry->pos != key.pos) || (entry->symbolNo != key.symbolNo))
+                    continue;
+
+                found.end = entry->end;
+                found.node = (entry->nodeOffset == noNode) ? nullptr : restore(entry->nodeOffset);
+                return true;
+            }
+            return false;
+        }
+};
+
+MemoSpill memoSpill;
+
+PNode spilledStub(uint64_t offset) {
+    return memoSpill.stub(offset);
+}
+
+PNode MemoSpill::restore(uint64_t offset) {
+    PNode node = restoreNode(arena.map, arena.mapped, offset, symbols, nullptr, spilledStub);
+    if (!node) {
+        std::cout << "Error reading spilled memo\n";
+        exit(1);
+    }
+    return node;
+}
+
+PNode SpilledNode::restore() const {
+    return memoSpill.restore(offset);
+}
+
+// Find entry in memory, or else on disk (putting it back in memory)
+auto findMemo(const std::pair<size_t, std::string>& index) {
+    auto entry = memo.find(index);
+    MemoEntry spilled;
+    if ((entry == memo.end()) && memoSpill.find(index, spilled))
+        entry = memo.emplace(index, spilled).first;
+    return entry;
+})";
+
+/* Code saving the tokens and memo to a checkpoint file every checkpointInterval seconds, so
+ * that a parse that is stopped can be resumed by another process: the parse starts again
+ * with the memo loaded, and finds the work already done there instead of repeating it
+ * Each checkpoint is written to a temporary file that then replaces the old one, so a
+ * checkpoint is never left half written; one whose tokens differ from the input's, or that
+ * is damaged, is not used. Memo entries spilled to disk, and entries that cannot be rebuilt,
+ * are not saved. Error messages printed before a checkpoint are not saved either, so a
+ * resumed parse gives the same tree and verdict, but does not repeat them */
+static std::string checkpointCode = R"(
+
+#include <chrono>
+
+class Checkpoint {
+    std::string fileName = "";
+    std::chrono::steady_clock::time_point last;
+    size_t ticks = 0;
+
+    template <typename T>
+    static void write(std::string& data, T value) {
+        data.append((const char *)&value, sizeof(T));
+    }
+
+    static void writeString(std::string& data, const std::string& text) {
+        write(data, (uint32_t)text.length());
+        data += text;
+    }
+
+    static std::string readString(ArenaReader& reader) {
+        uint32_t length = reader.read<uint32_t>();
+        const char *text = reader.skip(length);
+        return (text == nullptr) ? "" : std::string(text, length);
+    }
+
+    /* Load memo from checkpoint data, if its tokens are those of the input; every read is
+     * checked, and the memo is only changed if the whole checkpoint is sound */
+    bool load(const std::string& data) {
+        ArenaReader reader = {data.data(), data.length()};
+        const char *magic = reader.skip(5);
+        if ((magic == nullptr) || (memcmp(magic, "BGCK1", 5) != 0) || (reader.read<uint64_t>() != sentence.size()))
+            return false;
+        for (const TOKEN& token : sentence) {
+            if ((reader.read<int>() != token.id) || (reader.read<int>() != token.lineNo) || (reader.read<int>() != token.columnNo) || (readString(reader) != token.str) || reader.failed)
+                return false;
+        }
+
+        uint64_t symbolCount = reader.read<uint64_t>();
+        if (reader.failed || (symbolCount > (reader.length - reader.at) / sizeof(uint32_t)))
+            return false; // each symbol takes at least its length
+        std::vector<std::string> symbols(symbolCount);
+        for (std::string& symbol : symbols)
+            symbol = readString(reader);
+        uint64_t entryCount = reader.read<uint64_t>();
+        const size_t entrySize = 4 * sizeof(uint64_t);
+        const char *entryData = (entryCount <= (reader.length - reader.at) / entrySize) ? reader.skip(entryCount * entrySize) : nullptr;
+        uint64_t arenaLength = reader.read<uint64_t>();
+        const char *arena = reader.skip(arenaLength);
+        if (reader.failed || (entryData == nullptr) || (arena == nullptr))
+            return false;
+        std::vector<uint64_t> entries(4 * entryCount);
+        memcpy(entries.data(), entryData, entryCount * entrySize);
+
+        std::map<std::pair<size_t, std::string>, MemoEntry> loaded;
+        std::unordered_map<uint64_t, PNode> restored;
+        for (size_t entryNo = 0; entryNo < entries.size(); entryNo += 4) {
+            uint64_t entryPos = entries[entryNo], symbolNo = entries[entryNo + 1], end = entries[entryNo + 2], nodeOffset = entries[entryNo + 3];
+            if ((entryPos > sentence.size()) || (symbolNo >= symbols.size()) || (end < entryPos) || (end > sentence.size()))
+                return false;
+            PNode node = (nodeOffset == noNode) ? nullptr : restoreNode(arena, arenaLength, nodeOffset, symbols, &restored);
+            if ((nodeOffset != noNode) && (node == nullptr))
+                return false;
+            loaded[std::make_pair(entryPos, symbols[symbolNo])] = {node, end};
+        }
+        for (auto& entry : loaded)
+            memo[entry.first] = std::move(entry.second);
+        return true;
+    }
+
+    public:
+        // Start saving to file, resuming from it if it holds a checkpoint for the input
+        void start(const std::string& name) {
+            fileName = name;
+            last = std::chrono::steady_clock::now();
+            FILE *file = fopen(name.c_str(), "rb");
+            if (file == NULL)
+                return;
+
+            std::string data = "";
+            char buffer[1 << 16];
+            size_t length;
+            while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+                data.append(buffer, length);
+            fclose(file);
+            if (load(data))
+                std::cerr << "Resuming from checkpoint " + name + "\n";
+            else
+                std::cerr << "Checkpoint " + name + " is damaged or not for this input, so it is not used\n";
+        }
+
+        // Called for each memo entry added; saves if the interval has passed
+        void tick() {
+            if ((fileName == "") || (++ticks % 4096 != 0))
+                return;
+            if (std::chrono::steady_clock::now() - last < std::chrono::seconds(checkpointInterval))
+                return;
+            save();
+            last = std::chrono::steady_clock::now();
+        }
+
+        void save() {
+            std::string data = "BGCK1";
+            write(data, (uint64_t)sentence.size());
+            for (const TOKEN& token : sentence) {
+                write(data, token.id);
+                write(data, token.lineNo);
+                write(data, token.columnNo);
+                writeString(data, token.str);
+            }
+
+            std::map<const ParseNode*, uint64_t> offsets;
+            std::map<std::string, uint64_t> symbolNos;
+            ArenaWriter writer(0, offsets, symbolNos);
+            std::vector<uint64_t> entries;
+            for (const auto& entry : memo) {
+                uint64_t nodeOffset = noNode;
+                if (entry.second.node) {
+                    auto offset = offsets.find(entry.second.node.get());
+                    if (offset == offsets.end()) {
+                        walkTree(entry.second.node, writer);
+                        offset = offsets.find(entry.second.node.get());
+                    }
+                    if (offset == offsets.end())
+                        continue; // holds a value
+                    nodeOffset = offset->second;
+                }
+                uint64_t symbolNo = symbolNos.emplace(entry.first.second, symbolNos.size()).first->second;
+                entries.insert(entries.end(), {entry.first.first, symbolNo, entry.second.end, nodeOffset});
+            }
+
+            std::vector<std::string> symbols(symbolNos.size());
+            for (const auto& symbol : symbolNos)
+                symbols[symbol.second] = symbol.first;
+            write(data, (uint64_t)symbols.size());
+            for (const std::string& symbol : symbols)
+                writeString(data, symbol);
+            write(data, (uint64_t)(entries.size() / 4));
+            data.append((const char *)entries.data(), entries.size() * sizeof(uint64_t));
+            write(data, (uint64_t)writer.records.length());
+            data += writer.records;
+
+            std::string tempName = fileName + ".tmp";
+            FILE *file = fopen(tempName.c_str(), "wb");
+            bool written = (file != NULL) && (fwrite(data.data(), 1, data.length(), file) == data.length());
+            written = (file != NULL) && (fclose(file) == 0) && written;
+            if (!written || (rename(tempName.c_str(), fileName.c_str()) != 0))
+                std::cerr << "Error writing checkpoint " + fileName + "\n";
+        }
+};
+
+Checkpoint checkpoint;)";
+
+/* Code counting the cost of parsing for performance fuzzing: each call of a non-terminal's
+ * function that is not a memo hit costs 1, the deepest nesting of calls is kept, and each
+ * non-terminal with the rule it matched by (or -1 if it did not match) is a feature, for
+ * coverage; a rule sets fuzzRule as it returns, so after any non-terminals it calls
+ * Memo policies are reset for each run, so that the cost of an input does not depend on
+ * the inputs run before it */
+static std::string fuzzCountCode = R"(
+
+size_t fuzzRun = 0;   // number of current run
+size_t fuzzCost = 0;
+size_t fuzzDepth = 0, fuzzMaxDepth = 0;
+int fuzzIds = 0;      // number of functions given IDs
+int fuzzRule = -1;    // rule that last matched
+std::set<std::pair<int, int>> fuzzFeatures; // (function ID, rule matched)
+
+struct FuzzCall {
+    FuzzCall() {
+        fuzzDepth++;
+        fuzzMaxDepth = (fuzzDepth > fuzzMaxDepth) ? fuzzDepth : fuzzMaxDepth;
+    }
+    ~FuzzCall() {
+        fuzzDepth--;
+    }
+};)";
+
+static std::string fuzzCallCode = R"(    static size_t policyRun = 0;
+    static int fuzzId = fuzzIds++;
+    if (policyRun != fuzzRun) {
+        memoPolicy = MemoPolicy();
+        policyRun = fuzzRun;
+    }
+    FuzzCall fuzzCall;
+)";
+
+/* Generate code for performance fuzzing of the start symbol: inputs are token sequences,
+ * starting from the input file's tokens, and mutated by inserting, deleting, replacing,
+ * repeating and splicing tokens; an input is kept for further mutation if it reaches new
+ * features, or costs more than any input of its size range before
+ * The costliest input of each size range is reported, with how fast cost grows from the
+ * range before, then the costliest input is reported, and minimised by deleting tokens while
+ * its total cost stays within 90% of what it was (keeping cost per token instead would let
+ * the input of a parser whose cost grows linearly shrink to a token or two) */
+static std::string fuzzDriver(const std::string& startSymbol) {
+    return std::format(R"(
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+const size_t fuzzMaxLength = 256; // most tokens in an input
+
+struct FuzzInput {{
+    std::vector<int> tokens; // numbers of tokens in fuzzing alphabet
+    size_t cost = 0, depth = 0;
+
+    double costPerToken() const {{
+        return (double)cost / (tokens.empty() ? 1 : tokens.size());
+    }}
+}};
+
+std::vector<TOKEN> fuzzAlphabet;
+
+FuzzInput fuzzParse(const std::vector<int>& tokens, bool& newFeatures) {{
+    sentence.clear();
+    int columnNo = 0;
+    for (int tokenNo : tokens) {{
+        columnNo += fuzzAlphabet[tokenNo].str.length();
+        sentence.push_back(makeToken(fuzzAlphabet[tokenNo].str, fuzzAlphabet[tokenNo].id, 1, columnNo));
+    }}
+    memo.clear();
+    fuzzRun++;
+    fuzzCost = 0;
+    fuzzMaxDepth = 0;
+    size_t featureCount = fuzzFeatures.size();
+    pos = 0;
+    nonTerminal_{}(false);
+    newFeatures = (fuzzFeatures.size() > featureCount);
+    return {{tokens, fuzzCost, fuzzMaxDepth}};
+}}
+
+std::string fuzzText(const FuzzInput& input, bool spaced) {{
+    std::string text = "";
+    for (int tokenNo : input.tokens)
+        text += ((spaced && (text != "")) ? " " : "") + fuzzAlphabet[tokenNo].str;
+    return text;
+}}
+
+std::string fuzzReport(const FuzzInput& input) {{
+    return std::to_string(input.tokens.size()) + " tokens, cost " + std::to_string(input.cost) + " (" + std::to_string(input.costPerToken()) + " per token), depth " + std::to_string(input.depth);
+}}
+
+int fuzz(const std::map<std::string, int>& terminals, int seconds) {{
+    std::map<std::string, int> tokenNos;
+    for (const TOKEN& token : sentence) {{ // seed tokens include any compound tokens
+        if (tokenNos.emplace(token.str, fuzzAlphabet.size()).second)
+            fuzzAlphabet.push_back(token);
+    }}
+    for (const auto& term : terminals) {{
+        if (tokenNos.emplace(term.first, fuzzAlphabet.size()).second)
+            fuzzAlphabet.push_back(makeToken(term.first, term.second, 1, term.first.length()));
+    }}
+    std::vector<int> seed;
+    for (const TOKEN& token : sentence)
+        seed.push_back(tokenNos[token.str]);
+    if (seed.size() > fuzzMaxLength)
+        seed.resize(fuzzMaxLength);
+
+    std::mt19937 random(1);
+    auto below = [&](size_t n) {{
+        return (size_t)(random() % n);
+    }};
+    std::vector<FuzzInput> corpus;
+    std::map<size_t, FuzzInput> worst; // costliest input of each size range (lengths 2^n to 2^(n+1) - 1)
+    size_t runs = 0;
+    auto consider = [&](const std::vector<int>& tokens) {{
+        bool newFeatures;
+        FuzzInput input = fuzzParse(tokens, newFeatures);
+        runs++;
+        size_t range = 0;
+        while (((size_t)2 << range) <= tokens.size())
+            range++;
+        bool costlier = (input.cost > worst[range].cost);
+        if (costlier)
+            worst[range] = input;
+        if (newFeatures || costlier) {{
+            if (corpus.size() == 1024)
+                corpus[below(corpus.size())] = input;
+            else
+                corpus.push_back(input);
+        }}
+    }};
+
+    consider(seed);
+    for (size_t tokenNo = 0; tokenNo < fuzzAlphabet.size(); tokenNo++)
+        consider({{(int)tokenNo}});
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (std::chrono::steady_clock::now() < end) {{
+        std::vector<int> tokens = corpus[below(corpus.size())].tokens;
+        for (size_t mutationNo = 1 + below(4); mutationNo > 0; mutationNo--) {{
+            size_t at = below(tokens.size() + 1);
+            size_t length = std::min<size_t>(1 + below(8), tokens.size() - at);
+            switch (below(6)) {{
+                case 0: // insert token
+                    tokens.insert(tokens.begin() + at, below(fuzzAlphabet.size()));
+                    break;
+                case 1: // delete tokens
+                    tokens.erase(tokens.begin() + at, tokens.begin() + at + length);
+                    break;
+                case 2: // replace token
+                    if (at < tokens.size())
+                        tokens[at] = below(fuzzAlphabet.size());
+                    break;
+                case 3: {{ // repeat tokens
+                    std::vector<int> chunk(tokens.begin() + at, tokens.begin() + at + length);
+                    for (size_t copies = 1 + below(4); copies > 0; copies--)
+                        tokens.insert(tokens.begin() + at, chunk.begin(), chunk.end());
+                    break;
+                }}
+                case 4: {{ // splice with another input
+                    const std::vector<int>& other = corpus[below(corpus.size())].tokens;
+                    tokens.resize(at);
+                    tokens.insert(tokens.end(), other.begin() + below(other.size() + 1), other.end());
+                    break;
+                }}
+                default: // double input
+                    tokens.insert(tokens.end(), tokens.begin(), tokens.end());
+            }}
+        }}
+        if (tokens.size() > fuzzMaxLength)
+            tokens.resize(fuzzMaxLength);
+        consider(tokens);
+    }}
+
+    std::cout << std::to_string(runs) + " inputs run, " + std::to_string(corpus.size()) + " kept, " + std::to_string(fuzzFeatures.size()) + " features\n\nCostliest input of each size:\n";
+    FuzzInput previous, costliest;
+    for (const auto& range : worst) {{
+        std::string growth = "";
+        if ((previous.cost > 0) && (range.second.tokens.size() > previous.tokens.size()))
+            growth = ", cost grows as size^" + std::to_string(std::log((double)range.second.cost / previous.cost) / std::log((double)range.second.tokens.size() / previous.tokens.size()));
+        std::string text = fuzzText(range.second, true);
+        std::cout << "  " + fuzzReport(range.second) + growth + "\n    " + ((text.length() > 100) ? text.substr(0, 100) + " ..." : text) + "\n";
+        previous = range.second;
+        if (range.second.cost > costliest.cost)
+            costliest = range.second;
+    }}
+
+    // Report costliest input, then minimise it, keeping most of its cost
+    std::cout << "\nCostliest input: " + fuzzReport(costliest) + "\n  tokens: " + fuzzText(costliest, true) + "\n  text: " + fuzzText(costliest, false) + "\n";
+    size_t minCost = costliest.cost - costliest.cost / 10;
+    bool newFeatures;
+    for (size_t length = std::max<size_t>(costliest.tokens.size() / 2, 1); length > 0; length /= 2) {{
+        for (size_t at = 0; at + length <= costliest.tokens.size(); ) {{
+            std::vector<int> tokens = costliest.tokens;
+            tokens.erase(tokens.begin() + at, tokens.begin() + at + length);
+            FuzzInput smaller = fuzzParse(tokens, newFeatures);
+            if (!tokens.empty() && (smaller.cost >= minCost))
+                costliest = smaller;
+            else
+                at++;
+        }}
+    }}
+    std::cout << "\nMinimised costliest input: " + fuzzReport(costliest) + "\n  tokens: " + fuzzText(costliest, true) + "\n  text: " + fuzzText(costliest, false) + "\n";
+    return 0;
+}})",
+    startSymbol);
+}
+
+/* Code counting hardware events in each phase of the parser with perf_event_open, with the
+ * generator's PerfCounters class (the text of perf_counters.h, made by the Makefile); counters
+ * the machine or kernel does not provide are left out, and with none, only wall-clock time
+ * is reported
+ * The report is printed when main returns, per byte of input and per token */
+static std::string countersCode = R"(
+
+#include <optional>
+#include <sys/stat.h>
+)" + std::string(
+#include "perf_counters_code.h"
+) + R"(
+// Counters of main's phases, opened with --counters, and reported when main returns
+struct CounterReport {
+    std::optional<PerfCounters> perf;
+    size_t inputSize = 0;
+
+    void phase(const std::string& name) {
+        if (perf)
+            perf->start(name);
+    }
+
+    void start(FILE *file) {
+        struct stat fileStat;
+        if (perf && (fstat(fileno(file), &fileStat) == 0))
+            inputSize = fileStat.st_size;
+        phase("lexing");
+    }
+
+    ~CounterReport() {
+        if (perf) {
+            perf->stop();
+            perf->report({{"byte", inputSize}, {"token", sentence.size()}});
+        }
+    }
+};)";
+
+/* Generate code tracking allocations of the parser: global operator new and delete are
+ * replaced, and with --allocations, each allocation is counted against the non-terminal
+ * whose function is running (allocations of lexing, and of tree output, are outside
+ * non-terminals); the non-terminals that allocated most are printed at exit
+ * Each non-terminal function has a fixed site number, and counts are kept in arrays, so
+ * counting does not allocate */
+static std::string allocationCode() {
+    std::string siteNames = "\"(outside non-terminals)\"";
+    for (const auto& site : allocationSites)
+        siteNames += ", \"" + site.first + "\"";
+
+    return std::format(R"(
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+const size_t allocationSiteCount = {};
+const char *allocationSiteNames[allocationSiteCount] = {{{}}};
+size_t allocationCounts[allocationSiteCount] = {{}};
+size_t allocationBytes[allocationSiteCount] = {{}};
+size_t allocationSite = 0; // site of non-terminal function running
+bool trackingAllocations = false;
+
+void *operator new(size_t size) {{
+    if (trackingAllocations) {{
+        allocationCounts[allocationSite]++;
+        allocationBytes[allocationSite] += size;
+    }}
+    void *block = malloc((size > 0) ? size : 1);
+    if (block == NULL)
+        throw std::bad_alloc();
+    return block;
+}}
+
+void *operator new[](size_t size) {{
+    return operator new(size);
+}}
+
+void operator delete(void *block) noexcept {{
+    free(block);
+}}
+
+void operator delete[](void *block) noexcept {{
+    free(block);
+}}
+
+void operator delete(void *block, size_t) noexcept {{
+    free(block);
+}}
+
+void operator delete[](void *block, size_t) noexcept {{
+    free(block);
+}}
+
+// Counts allocations against a site while it exists, then against the site before it
+struct AllocationScope {{
+    size_t outer;
+
+    AllocationScope(size_t site): outer(allocationSite) {{
+        allocationSite = site;
+    }}
+
+    ~AllocationScope() {{
+        allocationSite = outer;
+    }}
+}};
+
+// Print the 10 sites that allocated most bytes, with totals and allocations per token
+void reportAllocations() {{
+    trackingAllocations = false;
+    size_t totalCount = 0, totalBytes = 0;
+    size_t order[allocationSiteCount];
+    for (size_t site = 0; site < allocationSiteCount; site++) {{
+        totalCount += allocationCounts[site];
+        totalBytes += allocationBytes[site];
+        order[site] = site;
+    }}
+    std::sort(order, order + allocationSiteCount, [](size_t a, size_t b) {{return allocationBytes[a] > allocationBytes[b];}});
+
+    printf("\nAllocations\ntotal: %zu allocations, %zu bytes", totalCount, totalBytes);
+    if (!sentence.empty())
+        printf(", %.1f allocations per token", (double)totalCount / sentence.size());
+    printf("\n");
+    for (size_t i = 0; (i < 10) && (i < allocationSiteCount); i++) {{
+        size_t site = order[i];
+        if (allocationCounts[site] > 0) {{
+            printf("%s: %zu allocations, %zu bytes (%.1f%% of bytes), %.1f bytes per allocation\n", allocationSiteNames[site],
+                allocationCounts[site], allocationBytes[site], 100.0 * allocationBytes[site] / totalBytes, (double)allocationBytes[site] / allocationCounts[site]);
+        }}
+    }}
+}})",
+    allocationSites.size() + 1, siteNames);
+}
+
+/* Code printing a parse tree as a DAG: nodes reached more than once (results of the same
+ * non-terminal at the same position, shared through the memo) are found first, then each
+ * is printed in full the first time with an ID, and as a reference to the ID after that,
+ * so the output is linear in the number of distinct nodes
+ * Within subtrees moved to disk with --memo-limit, only the subtrees themselves are found
+ * to be shared */
+static std::string dagCode = R"(
+
+class SharedNodeFinder: public TreeWalker {
+    std::set<const ParseNode*> seen;
+
+    public:
+        std::set<const ParseNode*> shared;
+
+        bool enter(const ParseNode *node) override {
+            if (seen.insert(node).second)
+                return true;
+            shared.insert(node);
+            return false;
+        }
+        bool enterSpilled(uint64_t offset) override {
+            return false; // nodes rebuilt from disk are freed after being walked, so are not looked for
+        }
+};
+
+// Prints the tree as toString does, with shared nodes printed once
+class DagPrinter: public TreeWalker {
+    std::set<const ParseNode*> shared;
+    std::map<const ParseNode*, std::pair<int, std::string>> ids; // ID and first line of each shared node printed
+    const ParseNode *current = nullptr;                          // node entered, if shared and not yet printed
+    const ParseNode *headerNode = nullptr;                       // shared node of header
+    std::string header = "";                                     // non-terminal not yet printed, as it may be empty
+    int depth = 0;
+
+    // Print line for node at current depth, with ID if node is shared
+    void printLine(const std::string& line, const ParseNode *node, const std::string& suffix) {
+        std::string text = makeIndent(depth) + line;
+        if (node != nullptr) {
+            int id = ids.size() + 1;
+            ids[node] = std::make_pair(id, line);
+            text += " [#" + std::to_string(id) + "]";
+        }
+        std::cout << text + suffix + "\n";
+    }
+
+    void printHeader(const std::string& suffix) {
+        if (header == "")
+            return;
+        depth--;
+        printLine(header, headerNode, suffix);
+        depth++;
+        header = "";
+    }
+
+    public:
+        DagPrinter(std::set<const ParseNode*> s): shared(std::move(s)) {}
+
+        bool enter(const ParseNode *node) override {
+            printHeader("");
+            current = nullptr;
+            if (shared.count(node) == 0)
+                return true;
+
+            auto id = ids.find(node);
+            if (id == ids.end()) {
+                current = node;
+                return true;
+            }
+            printLine(id->second.second, nullptr, " [see #" + std::to_string(id->second.first) + "]");
+            return false;
+        }
+        void enterNonTerminal(const std::string& symbol) override {
+            header = "NON-TERMINAL: " + symbol;
+            headerNode = current;
+            depth++;
+        }
+        void enterConjunct() override {
+            printHeader("");
+            printLine("CONJUNCT", nullptr, "");
+            depth++;
+        }
+        void leave() override {
+            printHeader(" [EPSILON]");
+            depth--;
+        }
+        void terminal(const TOKEN& token) override {
+            printLine("TERMINAL" + displayPos(token.lineNo, token.columnNo) + ": " + token.str, current, "");
+        }
+        void value(const std::string& symbol, const std::string& value) override {
+            printLine("NON-TERMINAL: " + symbol + " = " + value, current, "");
+        }
+};)";
+
+/* Generate code for parsing a non-terminal compiled to a DFA
+ * The DFA is run from the current position in a single loop; the tree node holds the
+ * matched tokens directly */
+static std::string regularNonTerminal(const std::string& nt, const std::string& ntStr, bool merged, const std::string& expected) {
+    return std::format(R"(
+
+PNode nonTerminal_{}(bool wanted{}) {{
+{}{}
+    long matchEnd = matchRegular(dfaNext, dfaAccept, followNext, followAccept);
+    if (matchEnd < 0) {{
+        tokenFail(wanted, nextK(false), "{}");
+        return nullptr;
+    }}
+
+    PNodeList leaves;
+    while (pos < (size_t)matchEnd)
+        leaves.push_back(std::make_shared<Leaf>(sentence[pos++]));
+    std::vector<PNodeList> subTreeVersions;
+    if (!leaves.empty())
+        subTreeVersions.push_back(std::move(leaves));
+    return std::make_shared<Internal>({}, std::move(subTreeVersions));
+}})",
+    nt, merged ? ", std::string nt" : "", dfaTables(regularDfas[nt], "dfa"), dfaTables(followDfas[nt], "follow"), expected, ntStr);
+}
+
+//--------------------------------//
+// Lookahead DFA Code Generation //
+//--------------------------------//
+
+/* State of a lookahead DFA, which chooses a rule for a non-terminal by reading one token
+ * at a time, only as far as needed to tell the rules apart */
+struct LookaheadState {
+    int ruleNo = -1; // rule for the sequence ending at this state (-1 if none)
+    std::map<std::string, LookaheadState> next; // transition for each terminal
+};
+
+// Get set of rules that can still be chosen from a DFA state
+static std::set<int> stateRules(const LookaheadState& state) {
+    std::set<int> ruleNos;
+    if (state.ruleNo >= 0)
+        ruleNos.insert(state.ruleNo);
+    for (const auto& transition : state.next) {
+        std::set<int> nextRules = stateRules(transition.second);
+        ruleNos.insert(nextRules.cbegin(), nextRules.cend());
+    }
+    return ruleNos;
+}
+
+// Indent each line of code by given number of levels
+static std::string indentCode(const std::string& code, int depth) {
+    std::string indent(4 * depth, ' ');
+    std::string result = "";
+    size_t lineStart = 0;
+    while (lineStart < code.length()) {
+        size_t lineEnd = code.find('\n', lineStart);
+        result += indent + code.substr(lineStart, lineEnd - lineStart + 1);
+        lineStart = lineEnd + 1;
+    }
+    return result;
+}
+
+/* Generate nested switch statement for a DFA state, which reads the token at the given
+ * depth past the current position
+ * fallback is the code for the longest sequence matched so far, used if no transition
+ * matches; tokens whose code is the same as the fallback are left to the default case
+ * Tokens that lead to identical code share a case */
+static std::string dfaStateCode(const LookaheadState& state, const std::string& ntStr, size_t depth, std::string fallback) {
+    if (state.ruleNo >= 0)
+        fallback = std::format("newNode = {}(wanted, {});\n", ruleNames[state.ruleNo], ntStr);
+
+    // If only one rule is possible, no more tokens need to be read
+    std::set<int> ruleNos = stateRules(state);
+    if (ruleNos.size() == 1)
+        return std::format("newNode = {}(wanted, {});\n", ruleNames[*ruleNos.begin()], ntStr);
+
+    // Group tokens by the code for their transitions
+    std::vector<std::pair<std::string, StrVec>> cases;
+    for (const auto& transition : state.next) {
+        std::string caseCode = dfaStateCode(transition.second, ntStr, depth + 1, fallback);
+        if (caseCode == fallback)
+            continue;
+
+        auto sameCase = std::find_if(cases.begin(), cases.end(), [&](const auto& c) {
+            return c.first == caseCode;
+        });
+        if (sameCase == cases.end())
+            cases.push_back(make_pair(caseCode, StrVec({transition.first})));
+        else
+            (sameCase->second).push_back(transition.first);
+    }
+    if (cases.empty())
+        return fallback;
+
+    std::string posStr = (depth == 0) ? "pos" : "pos + " + std::to_string(depth);
+    std::string switchCode = "switch (tokenAt(" + posStr + ")) {\n";
+    for (const auto& c : cases) {
+        for (const std::string& term : c.second)
+            switchCode += std::format("    case {}: // \"{}\"\n", terminalIds[term], classDisplays[term]);
+        switchCode += indentCode(c.first, 2) + "        break;\n";
+    }
+    return switchCode + "    default:\n" + indentCode(fallback, 2) + "}\n";
+}
+
+// Generate code choosing a rule for a non-terminal using a lookahead DFA
+static std::string dfaCases(const std::string& nt, const std::string& ntStr, const std::string& expected) {
+    LookaheadState initial;
+
+    // Build DFA from sequences paired with the non-terminal in the parse table
+    for (const auto& entry : tableRows(nt).bySeq) {
+        LookaheadState *state = &initial;
+        for (const std::string& term : entry.first) {
+            if (term != "")
+                state = &(state->next[term]);
+        }
+        state->ruleNo = entry.second;
+    }
+
+    // If no sequence matches, parsing fails
+    std::string failCode = std::format("tokenFail(wanted, nextK(false), \"{}\");\n", expected);
+    return indentCode(dfaStateCode(initial, ntStr, 0, failCode), 2);
+}
+
+/* Get sequences paired with non-terminal in the parse table, in descending order of
+ * length, and list them in expected for error messages */
+static std::vector<std::string> tableSequences(const std::string& nt, std::string& expected) {
+    std::vector<std::string> sequences;
+
+    // Show each sequence in error messages as the classes of terminals it stands for
+    const TableRows& rows = tableRows(nt);
+    std::map<std::string, std::string> seqDisplays;
+    for (const auto& entry : rows.bySeq) {
+        std::string seqStr = "", displayStr = "";
+        for (const std::string& term : entry.first) {
+            seqStr += term;
+            displayStr += (term == "") ? "" : classDisplays[term];
+        }
+        seqDisplays[seqStr] = displayStr;
+    }
+
+    for (const auto& entry : rows.bySeqStr)
+        sequences.push_back(entry.first); // sequence
+    std::sort(sequences.begin(), sequences.end(), [](std::string& a, std::string& b) {
+        return a.length() > b.length();
+    }); // sort sequences in descending order of length
+
+    // Add each sequence to list of expected sequences
+    for (const std::string& s : sequences) {
+        std::string displayS = (s == "") ? "EOF" : seqDisplays[s];
+        expected = (expected == "") ? expected += displayS : expected += ", " + displayS;
+    }
+    return sequences;
+}
+
+/* Generate code choosing a rule for a non-terminal by the next k tokens, with the given
+ * code (indented one level) for each rule, or failing with failReturn if no sequence in
+ * the parse table matches
+ * Consecutive sequences choosing the same rule share a case */
+static std::string ruleChoice(const std::string& nt, const std::function<std::string(int)>& ruleCode, const std::string& failReturn) {
+    std::string expected = "";
+    std::vector<std::pair<int, StrVec>> cases; // rule, and sequences choosing it
+    std::vector<std::string> sequences = tableSequences(nt, expected);
+    const std::map<std::string, int>& ruleFor = tableRows(nt).bySeqStr;
+    for (const std::string& s : sequences) {
+        int ruleNo = ruleFor.at(s);
+        if (cases.empty() || (cases.back().first != ruleNo))
+            cases.push_back(make_pair(ruleNo, StrVec()));
+        (cases.back().second).push_back(std::format("startsWith(nextKTokens, \"{}\")", s));
+    }
+
+    std::string choice = "std::string nextKTokens = nextK(true);\n";
+    for (const auto& c : cases) {
+        std::string condition = "";
+        for (const std::string& test : c.second)
+            condition += (condition == "") ? test : " || " + test;
+        choice += std::format("{}if ({}) {{\n{}", (&c == &cases.front()) ? "" : "} else ", condition, ruleCode(c.first));
+    }
+
+    std::string failCode = std::format("tokenFail(wanted, nextK(false), \"{}\");\n{}", expected, failReturn);
+    return choice + (cases.empty() ? failCode : "} else {\n" + indentCode(failCode, 1) + "}\n");
+}
+
+/* Generate precedence climbing function for a non-terminal E with precedence levels,
+ * which parses an expression whose operators have at least the given precedence (levels
+ * are numbered from 1, lowest first), choosing by lookahead with the parse tables of the
+ * non-terminals made for the levels
+ * Operands are parsed by the rules of E__operand; each use of an operator is a node named
+ * E, holding the operator and its operands in order */
+static std::string climbFunction(const std::string& nt) {
+    const std::vector<OperatorLevel>& levels = operatorLevels[nt];
+    auto levelNo = [&](int ruleNo) {
+        std::string first = rules[ruleNo][0]->getSymbols()[0].str;
+        for (size_t level = 1; level <= levels.size(); level++) {
+            if (first == nt + "__op" + std::to_string(level))
+                return (int)level;
+        }
+        return 0; // rule for operand, or empty rule
+    };
+    std::string operatorNode = "    PNode op = std::make_shared<Leaf>(sentence[pos++]);\n";
+
+    // Operand, or prefix operator applied to expression of at least its precedence
+    std::string unitCode = "PNode left;\n" + ruleChoice(nt + "__unit", [&](int ruleNo) {
+        int level = levelNo(ruleNo);
+        if (level == 0) {
+            std::string operandCode = ruleChoice(nt + "__operand", [&](int operandRule) {
+                return std::format("    left = {}(wanted, \"{}\");\n", ruleNames[operandRule], nt);
+            }, "return nullptr;\n");
+            return indentCode(operandCode, 1) + "    if (!left)\n        return nullptr;\n";
+        }
+        return operatorNode + std::format(
+R"(    PNode operand = climb_{}(wanted, {});
+    if (!operand)
+        return nullptr;
+    left = std::make_shared<Internal>("{}", std::vector<PNodeList>({{{{op, operand}}}}));
+)",
+        nt, level, nt);
+    }, "return nullptr;\n");
+
+    /* Binary operator of at least minimum precedence, followed by expression of higher
+     * precedence (or the same precedence, if right-associative) */
+    std::string infixCode = "break;\n";
+    if (std::any_of(levels.cbegin(), levels.cend(), [](const OperatorLevel& level) {
+        return (level.type == LEFT_OP) || (level.type == RIGHT_OP);
+    })) {
+        infixCode = ruleChoice(nt + "__infix", [&](int ruleNo) {
+            int level = levelNo(ruleNo);
+            if (level == 0)
+                return std::string("    break;\n");
+            int rightLevel = (levels[level - 1].type == LEFT_OP) ? level + 1 : level;
+            return std::format("    if ({} < minPrec)\n        break;\n", level) + operatorNode + std::format(
+R"(    PNode right = climb_{}(wanted, {});
+    if (!right)
+        return nullptr;
+    left = std::make_shared<Internal>("{}", std::vector<PNodeList>({{{{left, op, right}}}}));
+)",
+            nt, rightLevel, nt);
+        }, "return nullptr;\n");
+    }
+
+    // Postfix operator of at least minimum precedence, checked before binary operators
+    std::string loopCode = infixCode;
+    if (std::any_of(levels.cbegin(), levels.cend(), [](const OperatorLevel& level) {return level.type == POSTFIX_OP;})) {
+        loopCode = ruleChoice(nt + "__postfix", [&](int ruleNo) {
+            int level = levelNo(ruleNo);
+            if (level == 0)
+                return indentCode(infixCode, 1);
+            return std::format("    if ({} < minPrec)\n        break;\n", level) + operatorNode + std::format(
+R"(    left = std::make_shared<Internal>("{}", std::vector<PNodeList>({{{{left, op}}}}));
+)",
+            nt);
+        }, "return nullptr;\n");
+    }
+
+    return std::format(R"(
+
+PNode climb_{}(bool wanted, int minPrec) {{
+{}    while (true) {{
+{}    }}
+    return left;
+}})",
+    nt, indentCode(unitCode, 1), indentCode(loopCode, 2));
+}
+
+// Generate code for parsing a non-terminal
+static std::string parseNonTerminal(const std::string& nt, bool lookaheadDFA) {
+    std::string ntCases = "";
+    std::string expected = "";
+
+    /* Name of tree node; a non-terminal that duplicates have been merged into is passed
+     * the name of the non-terminal being parsed
+     * Its memo entries are shared by all of those names, so a node found in the memo is
+     * relabelled if it was parsed under another name */
+    bool merged = (mergedNts.count(nt) > 0);
+    std::string ntStr = merged ? "nt" : "\"" + nt + "\"";
+
+    // For each sequence that is paired with the non-terminal in the parse table, add a case
+    std::vector<std::string> sequences = tableSequences(nt, expected);
+    const std::map<std::string, int>& ruleFor = tableRows(nt).bySeqStr;
+    int caseNo = 0;
+    for (std::string s : sequences) {
+        int ruleNo = ruleFor.at(s);
+        std::string elseStr = "";
+        if (caseNo > 0)
+            elseStr = "} else ";
+
+        // Add code for which rule to use in this case
+        ntCases += std::format(
+R"(
+        {}if (startsWith(nextKTokens, "{}")) {{
+            newNode = {}(wanted, {});
+)", 
+        elseStr, s, ruleNames[ruleNo], ntStr);
+        caseNo++;
+    }
+
+    // Non-terminal compiled to a DFA is parsed by running it
+    if (regularDfas.count(nt) > 0)
+        return regularNonTerminal(nt, ntStr, merged, expected);
+
+    // Non-terminal with precedence levels is parsed by precedence climbing
+    std::string climbCode = "";
+    if (operatorLevels.count(nt) > 0) {
+        climbCode = climbFunction(nt);
+        ntCases = "        newNode = climb_" + nt + "(wanted, 0);\n";
+
+    // If function does not return after any case, parsing fails
+    } else if (lookaheadDFA) {
+        ntCases = dfaCases(nt, ntStr, expected);
+    } else {
+        ntCases = std::format(
+R"(        std::string nextKTokens = nextK(true);{}
+        }} else {{
+            tokenFail(wanted, nextK(false), "{}");
+            newNode = nullptr;
+        }}
+)",
+        ntCases, expected);
+    }
+
+    /* Count allocations of the function, and of the rules and EBNF operators it calls,
+     * against it; the non-terminals it calls have sites of their own, so their allocations
+     * count against them, and counting against this one resumes when they return */
+    std::string allocationScope = "";
+    if (allocationSites.count(nt) > 0)
+        allocationScope = "    AllocationScope allocationScope(" + std::to_string(allocationSites[nt]) + ");\n";
+
+    // Add cases to the non-terminal's numbered function
+    return climbCode + std::format(R"(
+
+PNode nonTerminal_{}(bool wanted{}) {{
+    static MemoPolicy memoPolicy;
+{}    std::pair<size_t, std::string> memoIndex = std::make_pair(pos, {});
+    bool useMemo = memoPolicy.active();
+    auto entry = useMemo ? {}(memoIndex) : memo.end();
+    if (useMemo)
+        memoPolicy.record(entry != memo.end());
+
+    if (entry == memo.end()) {{
+        PNode newNode;
+{}{}
+        if (useMemo)
+            {}
+        return newNode;
+    }}
+
+    pos = entry->second.end;
+    return {};
+}})", 
+    nt, merged ? ", std::string nt" : "", allocationScope + (fuzzing ? fuzzCallCode : ""), "\"" + nt + "\"", memoSpilling ? "findMemo" : "memo.find", ntCases,
+    fuzzing ? "        fuzzCost++;\n        fuzzFeatures.insert(std::make_pair(fuzzId, (newNode != nullptr) ? fuzzRule : -1));\n" : "",
+    (memoSpilling || memoCheckpoints) ? "addMemo(memoIndex, {newNode, pos});" : "memo[memoIndex] = {newNode, pos};",
+    merged ? "relabel(entry->second.node, nt)" : "entry->second.node");
+}
+
+/* Generate code for parsing a non-terminal made for an EBNF operator, which is parsed in
+ * place: its function adds the nodes of the chosen rule's symbols to the caller's list
+ * A rule ending with the non-terminal itself (repetition) goes round a loop instead of
+ * recursing, choosing a rule by lookahead again on each iteration; the loop also ends
+ * after an iteration that has not moved on, so repeating an empty sequence cannot hang */
+static std::string parseEbnfNonTerminal(const std::string& nt) {
+    bool loop = false;
+    std::string choice = ruleChoice(nt, [&](int ruleNo) {
+        SymbVec symbols = rules[ruleNo][0]->getSymbols();
+        bool repeat = (symbols.back().type == NON_TERM) && (symbols.back().str == nt);
+        if (repeat)
+            symbols.pop_back();
+        loop = loop || repeat;
+
+        size_t refNo = 0;
+        return parseSymbSeq(symbols, true, "children", "false", ruleRefNames[ruleNo], refNo, {})
+            + (repeat ? "    if (pos > iterationStart)\n        continue;\n    return true;\n" : "    return true;\n");
+    }, "return false;\n");
+    if (loop)
+        choice = "while (true) {\n    size_t iterationStart = pos;\n" + indentCode(choice, 1) + "}\n";
+
+    return std::format(R"(
+
+bool nonTerminal_{}(bool wanted, PNodeList& children) {{
+{}}})",
+    nt, indentCode(choice, 1));
+}
+
+/* Generate function finding the longest compound token at a position of the input,
+ * running each token's DFA over characters (tokens never match the same string, so
+ * there are no ties) */
+static std::string compoundTokenFunction() {
+    std::string tables = "", matches = "";
+    int tokenNo = 0;
+    for (const auto& token : compoundTokens) {
+        std::string name = "token" + std::to_string(tokenNo++);
+        tables += dfaTables(token.second, name);
+        matches += std::format(R"(
+    len = longestMatch(input, i, {}Next, {}Accept);
+    if (len > match.first)
+        match = {{len, {}}}; // {}
+)",
+        name, name, terminalIds[token.first], token.first);
+    }
+
+    return std::format(R"(
+
+size_t longestMatch(const std::string& input, size_t i, const int *next, const bool *accept) {{
+    size_t matchLen = 0;
+    int state = 0;
+    for (size_t j = i; j < input.length(); j++) {{
+        state = next[state * 256 + (unsigned char)input[j]];
+        if (state < 0)
+            break;
+        if (accept[state])
+            matchLen = j - i + 1;
+    }}
+    return matchLen;
+}}
+
+std::pair<size_t, int> compoundToken(const std::string& input, size_t i) {{
+{}
+    std::pair<size_t, int> match = {{0, -1}};
+    size_t len;{}
+    return match;
+}})",
+    tables, matches);
+}
+
+/* Lexer: reads characters from input file a window of maxTermLen characters at a time,
+ * and converts them to tokens, taking the longest terminal at the start of the window */
+static std::string windowLexer = R"(    std::string currentStr = "";
+    int lineNo = 1;
+    int columnNo = 1;
+    int maxMatchLen = 0;
+    char currentChar = fgetc(inputFile);
+    while (currentChar != EOF) {
+        bool newLine = false;
+        if ((currentChar == '\n') || (currentChar == '\r')) {
+            char nextChar;
+            if ((nextChar = fgetc(inputFile)) != EOF)
+                currentStr += currentChar;
+            currentChar = nextChar;
+            newLine = true;
+        } else {
+            currentStr += currentChar;
+            currentChar = fgetc(inputFile);
+        }
+
+        if (terminals.count(currentStr) > 0)
+            maxMatchLen = currentStr.length();
+
+        if (currentStr.length() == maxTermLen) {
+            if (maxMatchLen == 0) {
+                std::cout << "Lexer error [ln " + std::to_string(lineNo) + ", col " + std::to_string(columnNo - currentStr.length() + 1) + "]: unrecognised sequence '" + currentStr + "'\n";
+                return 1;
+            }
+
+            std::string tokenStr = currentStr.substr(0, maxMatchLen);
+            sentence.push_back(makeToken(tokenStr, terminals[tokenStr], lineNo, columnNo));
+            currentStr.erase(0, maxMatchLen);
+            maxMatchLen = 0;
+        }
+
+        columnNo++;
+        if (newLine) {
+            lineNo++;
+            columnNo = 1;
+        }
+    }
+    fclose(inputFile);
+)";
+
+/* Lexer used when there are compound tokens: reads the whole input file, then takes the
+ * longest terminal or compound token at each position (a terminal if both are as long) */
+static std::string compoundLexer = R"(    std::string input = "";
+    int nextChar;
+    while ((nextChar = fgetc(inputFile)) != EOF)
+        input += (char)nextChar;
+    fclose(inputFile);
+    if (!input.empty() && ((input.back() == '\n') || (input.back() == '\r')))
+        input.pop_back(); // line break at end of file is not part of input
+
+    int lineNo = 1;
+    int columnNo = 1;
+    size_t i = 0;
+    while (i < input.length()) {
+        size_t termLen = (maxTermLen < input.length() - i) ? maxTermLen : input.length() - i;
+        while ((termLen > 0) && (terminals.count(input.substr(i, termLen)) == 0))
+            termLen--;
+
+        auto [tokenLen, tokenId] = compoundToken(input, i);
+        if ((termLen > 0) && (termLen >= tokenLen)) {
+            tokenLen = termLen;
+            tokenId = terminals[input.substr(i, termLen)];
+        }
+        if (tokenLen == 0) {
+            std::cout << "Lexer error [ln " + std::to_string(lineNo) + ", col " + std::to_string(columnNo) + "]: unrecognised sequence '" + input.substr(i, (maxTermLen > 0) ? maxTermLen : 1) + "'\n";
+            return 1;
+        }
+
+        std::string tokenStr = input.substr(i, tokenLen);
+        sentence.push_back(makeToken(tokenStr, tokenId, lineNo, columnNo + tokenLen - 1));
+        for (char c : tokenStr) {
+            columnNo++;
+            if ((c == '\n') || (c == '\r')) {
+                lineNo++;
+                columnNo = 1;
+            }
+        }
+        i += tokenLen;
+    }
+)";
+
+/* Main parser function
+ * Lexer converts input file to tokens
+ * Calls the parsing function for the start symbol
+ * Parser must stop at the end of the input for parsing to succeed
+ * If parsing succeeds, print parse tree
+ * Options before the input file come from the generator's options: with a batch
+ * recogniser, --batch recognises each line of the input file instead, with succinct
+ * output, --succinct <file> writes the tree to a file instead of printing it, and with DAG
+ * output, --dag prints (or writes) shared nodes once, with tree export, --json <file> and
+ * --sexp <file> write the tree to a file as JSON or S-expressions, and with checkpoints,
+ * --checkpoint <file> saves the memo to the file while parsing, resuming from it if it
+ * already holds a checkpoint, and with fuzzing, --fuzz <seconds> searches for costly inputs
+ * starting from the input file's tokens */
+static std::string mainFunction(const std::string& startSymbol, std::string terminalSet, std::string lexer, bool batch, bool succinct, bool dag, bool exportTrees, bool counters, bool allocations) {
+    std::string optionVars = "", optionCases = "", usage = "", batchCall = "", parseStart = "", treeOutput = "";
+    if (allocations) {
+        optionCases += "if (option == \"--allocations\") {\n            trackingAllocations = true;\n            atexit(reportAllocations);\n        } else ";
+        usage += "[--allocations] ";
+    }
+    if (counters) {
+        optionVars += "    CounterReport counters;\n";
+        optionCases += "if (option == \"--counters\")\n            counters.perf.emplace();\n        else ";
+        usage += "[--counters] ";
+        lexer = "    counters.start(inputFile);\n" + lexer;
+        parseStart += "    counters.phase(\"parsing\");\n";
+        treeOutput += "            counters.phase(\"tree output\");\n";
+    }
+    if (batch) {
+        optionVars += "    bool batchMode = false;\n";
+        optionCases += "if (option == \"--batch\")\n            batchMode = true;\n        else ";
+        usage += "[--batch] ";
+        batchCall = "    if (batchMode)\n        return recognizeFile(terminals);\n\n";
+    }
+    if (fuzzing) {
+        optionVars += "    int fuzzSeconds = 0;\n";
+        optionCases += "if ((option == \"--fuzz\") && (argNo < argc - 1))\n            fuzzSeconds = atoi(argv[argNo++]);\n        else ";
+        usage += "[--fuzz <seconds>] ";
+        parseStart += "    if (fuzzSeconds > 0)\n        return fuzz(terminals, fuzzSeconds);\n";
+    }
+    if (memoCheckpoints) {
+        optionVars += "    std::string checkpointFile = \"\";\n";
+        optionCases += "if ((option == \"--checkpoint\") && (argNo < argc - 1))\n            checkpointFile = argv[argNo++];\n        else ";
+        usage += "[--checkpoint <file>] ";
+        parseStart += "    if (checkpointFile != \"\")\n        checkpoint.start(checkpointFile);\n";
+    }
+    if (dag) {
+        optionVars += "    bool dagMode = false;\n";
+        optionCases += "if (option == \"--dag\")\n            dagMode = true;\n        else ";
+        usage += "[--dag] ";
+        treeOutput += R"(            std::set<const ParseNode*> shared;
+            if (dagMode) {
+                SharedNodeFinder finder;
+                walkTree(root, finder);
+                shared = std::move(finder.shared);
+            }
+)";
+    }
+    if (succinct) {
+        optionVars += "    std::string succinctFile = \"\";\n";
+        optionCases += "if ((option == \"--succinct\") && (argNo < argc - 1))\n            succinctFile = argv[argNo++];\n        else ";
+        usage += "[--succinct <tree file>] ";
+        treeOutput += std::format(R"(            if (succinctFile != "") {{
+                SuccinctWriter writer{};
+                walkTree(root, writer);
+                if (!writer.write(succinctFile)) {{
+                    std::cout << "Error writing " + succinctFile + "\n";
+                    return 1;
+                }}
+                return 0;
+            }}
+)",
+        dag ? "(shared)" : "");
+    }
+    if (exportTrees) {
+        optionVars += "    std::string exportFile = \"\";\n    bool json = true;\n";
+        optionCases += "if (((option == \"--json\") || (option == \"--sexp\")) && (argNo < argc - 1)) {\n            exportFile = argv[argNo++];\n            json = (option == \"--json\");\n        } else ";
+        usage += "[--json <tree file> | --sexp <tree file>] ";
+        treeOutput += std::format(R"(            if (exportFile != "") {{
+                FILE *file = fopen(exportFile.c_str(), "wb");
+                bool written = (file != NULL);
+                if (written) {{
+                    TreeExporter exporter(file, json{});
+                    walkTree(root, exporter);
+                    written = exporter.finish();
+                    written &= (fclose(file) == 0);
+                }}
+                if (!written) {{
+                    std::cout << "Error writing " + exportFile + "\n";
+                    return 1;
+                }}
+                return 0;
+            }}
+)",
+        dag ? ", shared" : "");
+    }
+    if (dag) {
+        treeOutput += R"(            if (dagMode) {
+                DagPrinter printer(shared);
+                walkTree(root, printer);
+                return 0;
+            }
+)";
+    }
+
+    std::string argCheck = "argc == 2";
+    if (optionCases != "") {
+        optionVars += std::format(R"(    int argNo = 1;
+    while ((argNo < argc - 1) && startsWith(argv[argNo], "--")) {{
+        std::string option = argv[argNo++];
+        {}
+            argNo = argc; // unknown option, so usage is shown
+    }}
+
+)",
+        optionCases.substr(0, optionCases.length() - 1));
+        argCheck = "argNo == argc - 1";
+    }
+
+    return std::format(R"(
+
+int main(int argc, char **argv) {{
+{}    if ({}) {{
+        inputFile = fopen(argv[argc - 1], "r");
+        if (inputFile == NULL)
+            std::cout << "Error opening file\n";
+    }} else {{
+        std::cout << "Usage: ./parser {}<input file>\n";
+        return 1;
+    }}
+
+    std::map<std::string, int> terminals = {};
+    
+    int maxTermLen = 0;
+    for (const auto& term : terminals)
+        maxTermLen = (maxTermLen > term.first.length()) ? maxTermLen : term.first.length();
+
+{}{}
+    if (sentence.empty()) {{
+        std::cout << "File is empty\n";
+        return 1;
+    }}
+
+{}    pos = 0;
+    PNode root = nonTerminal_{}(true);
+    if (root) {{
+        if (pos == sentence.size()) {{
+            std::cout << "Parsing successful\n";
+{}            std::cout << root->toString(0);
+            return 0;
+        }}
+
+        std::cout << "Parser error" + displayPos(sentence[pos].lineNo, sentence[pos].columnNo) + ": parsing terminated before end of input\n";
+    }}
+
+    std::cout << "Parsing failed\n";
+    return 1;
+}})", 
+    optionVars, argCheck, usage, terminalSet, batchCall, lexer, parseStart, startSymbol, treeOutput);
+}
+
+// Write code to file
+void RDCodegen(std::ostream& parserFile, StrVec ntOrder, int k, bool lookaheadDFA, bool batch, bool succinct, bool dag, bool exportTrees, size_t memoLimit, int checkpointInterval, bool fuzz, bool counters, bool allocations) {
+    parserFile << beginningCode;
+    if (!ntTypes.empty())
+        parserFile << valueCode;
+    memoSpilling = (memoLimit > 0);
+    memoCheckpoints = (checkpointInterval > 0);
+    if (memoSpilling || memoCheckpoints)
+        parserFile << arenaCode;
+    if (memoSpilling)
+        parserFile << "\n\nconst size_t memoLimit = " + std::to_string(memoLimit) + ";" + memoSpillCode;
+    if (memoCheckpoints)
+        parserFile << "\n\nconst int checkpointInterval = " + std::to_string(checkpointInterval) + "; // seconds" + checkpointCode;
+    fuzzing = fuzz;
+    if (fuzzing)
+        parserFile << fuzzCountCode;
+    if (memoSpilling || memoCheckpoints) {
+        parserFile << "\n\nvoid addMemo(const std::pair<size_t, std::string>& index, MemoEntry entry) {\n    memo[index] = entry;\n";
+        if (memoSpilling)
+            parserFile << "    if (memo.size() > memoLimit)\n        memoSpill.spill();\n";
+        if (memoCheckpoints)
+            parserFile << "    checkpoint.tick();\n";
+        parserFile << "}";
+    }
+
+    /* Number classes of terminals, and build strings representing map of terminals to
+     * token (class) IDs, and list of class representatives */
+    std::map<std::string, StrVec> classMembers;
+    for (const std::string& s : alphabet)
+        classMembers[terminalClasses[s]].push_back(s);
+
+    std::string classNames = "{";
+    int classNo = 0;
+    for (const auto& termClass : classMembers) {
+        std::string display = termClass.first;
+        if ((termClass.second).size() > 1) {
+            display = "";
+            for (const std::string& s : termClass.second)
+                display += (display == "") ? "[" + s : "|" + s;
+            display += "]";
+        }
+        classDisplays[termClass.first] = display;
+
+        if (classNo > 0)
+            classNames += ", ";
+        classNames += "\"" + termClass.first + "\"";
+        for (const std::string& s : termClass.second)
+            terminalIds[s] = classNo;
+        classNo++;
+    }
+    classNames += "}";
+
+    std::string terminalSet = "{";
+    for (const std::string& s : alphabet) {
+        if (compoundTokens.count(s) > 0)
+            continue; // recognised by DFA instead
+        if (terminalSet != "{")
+            terminalSet += ", ";
+        terminalSet += "{\"" + s + "\", " + std::to_string(terminalIds[s]) + "}";
+    }
+    terminalSet += "}";
+
+    /* Function for obtaining sequence of next k tokens
+     * Lookahead decisions use the representative of each token's class, while error
+     * messages use the tokens themselves */
+    parserFile << std::format(R"(
+
+std::vector<std::string> classNames = {};
+
+std::string nextK(bool classes) {{
+    std::string sequence = "";
+    int i = pos;
+    while ((i < sentence.size()) && (i < pos + {})) {{
+        sequence += classes ? classNames[sentence[i].id] : sentence[i].str;
+        i++;
+    }}
+    return sequence;
+}})",
+    classNames, k);
+
+    // Function for obtaining ID of token at given position (-1 if past end of input)
+    if (lookaheadDFA)
+        parserFile << R"(
+
+int tokenAt(size_t i) {
+    if (i < sentence.size())
+        return sentence[i].id;
+    return -1;
+})";
+
+    /* Non-terminals compiled to DFAs do not use rule functions, or call other non-terminals'
+     * functions; only write their functions if they are used by other non-terminals or are
+     * the start symbol
+     * Non-terminals made for EBNF operators are always parsed by their rules, in place, and
+     * are only written if used, so what their rules use is only counted once they are
+     * Non-terminals made for precedence levels are parsed by their owner's function, so
+     * they are never written, and their rules are only used if their owner is not compiled */
+    StrSet usedNts = {ntOrder.back()};
+    size_t usedCount = 0;
+    while (usedNts.size() > usedCount) {
+        usedCount = usedNts.size();
+        for (const auto& ruleEntry : rules) {
+            const std::string& nt = ruleNts[ruleEntry.first];
+            const std::string& owner = (operatorHelpers.count(nt) > 0) ? operatorHelpers[nt] : nt;
+            if ((ebnfNts.count(nt) > 0) ? (usedNts.count(nt) == 0) : (regularDfas.count(owner) > 0))
+                continue;
+            for (const GNode& conj : ruleEntry.second) {
+                StrSet conjRefs = conj->references();
+                usedNts.insert(conjRefs.cbegin(), conjRefs.cend());
+            }
+        }
+    }
+    StrVec sortedNts;
+    for (const std::string& nt : ntOrder) {
+        if (operatorHelpers.count(nt) > 0)
+            continue;
+        if ((usedNts.count(nt) > 0) || ((regularDfas.count(nt) == 0) && (ebnfNts.count(nt) == 0)))
+            sortedNts.push_back(nt);
+    }
+    if (!regularDfas.empty())
+        parserFile << regularCode(k, classNo);
+
+    /* Write forward declarations for non-terminal functions, so they can be called by
+     * rule functions
+     * Functions are named after non-terminals, and written in alphabetical order (rules
+     * are numbered in the same order), so that editing one part of the grammar only
+     * changes the code that depends on it */
+    std::sort(sortedNts.begin(), sortedNts.end());
+    allocationSites.clear();
+    if (allocations) {
+        for (const std::string& nt : sortedNts) {
+            if ((regularDfas.count(nt) == 0) && (ebnfNts.count(nt) == 0))
+                allocationSites.emplace(nt, allocationSites.size() + 1);
+        }
+        parserFile << allocationCode();
+    }
+    parserFile << "\n";
+    for (const auto& alias : ntAliases)
+        mergedNts.insert(alias.second);
+    if (!mergedNts.empty())
+        parserFile << aliasCode();
+    for (const std::string& nt : sortedNts) {
+        if (ebnfNts.count(nt) > 0)
+            parserFile << "\nbool nonTerminal_" + nt + "(bool wanted, PNodeList& children);";
+        else
+            parserFile << "\nPNode nonTerminal_" + nt + ((mergedNts.count(nt) > 0) ? "(bool wanted, std::string nt);" : "(bool wanted);");
+    }
+
+    /* Write parser functions for rules and non-terminals; a non-terminal with precedence
+     * levels only uses the rules of its operands */
+    for (const auto& ruleEntry : rules) {
+        const std::string& nt = ruleNts[ruleEntry.first];
+        if (operatorHelpers.count(nt) > 0) {
+            if ((regularDfas.count(operatorHelpers[nt]) == 0) && (nt == operatorHelpers[nt] + "__operand"))
+                parserFile << parseRule(ruleEntry.first, ruleEntry.second);
+        } else if ((regularDfas.count(nt) == 0) && (ebnfNts.count(nt) == 0) && (operatorLevels.count(nt) == 0)) {
+            parserFile << parseRule(ruleEntry.first, ruleEntry.second);
+        }
+    }
+    for (const std::string& nt : sortedNts)
+        parserFile << ((ebnfNts.count(nt) > 0) ? parseEbnfNonTerminal(nt) : parseNonTerminal(nt, lookaheadDFA));
+
+    // Start symbol is the last non-terminal in topological order
+    std::string lexer = windowLexer;
+    if (!compoundTokens.empty()) {
+        parserFile << compoundTokenFunction();
+        lexer = compoundLexer;
+    }
+    if (batch)
+        parserFile << batchRecogniser(ntOrder.back(), classNo);
+    if (succinct)
+        parserFile << succinctCode;
+    if (fuzzing)
+        parserFile << fuzzDriver(ntOrder.back());
+    if (dag)
+        parserFile << dagCode;
+    if (exportTrees)
+        parserFile << exportCode;
+    if (counters)
+        parserFile << countersCode;
+    parserFile << mainFunction(ntOrder.back(), terminalSet, lexer, batch, succinct, dag, exportTrees, counters, allocations); // write main function
 }
@@ -2,6 +2,6 @@
 #ifndef RD_CODEGEN_H
 #define RD_CODEGEN_H
 
-void RDCodegen(StrVec ntOrder, int k);
+void RDCodegen(std::ostream& parserFile, StrVec ntOrder, int k, bool lookaheadDFA, bool batch, bool succinct, bool dag, bool exportTrees, size_t memoLimit, int checkpointInterval, bool fuzz, bool counters, bool allocations);
 
 #endif
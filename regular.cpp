@@ -0,0 +1,540 @@
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <set>
+#include "grammar.h"
+#include "regular.h"
+
+std::map<std::string, TokenDfa> regularDfas;
+std::map<std::string, TokenDfa> followDfas;
+std::map<std::string, TokenDfa> compoundTokens;
+
+static std::map<std::string, int> classIds;       // token ID of each class representative
+static size_t classCount;                         // number of token IDs
+static size_t maxStates;                          // most states of any DFA built
+static bool byCharacter;                          // if true, DFAs are over characters (IDs 0-255)
+static std::map<std::string, TokenDfa> *compiled; // DFAs compiled so far
+
+//-------------------------//
+// Token-Level NFA and DFA //
+//-------------------------//
+
+/* NFA over token IDs, with epsilon transitions (ID -1)
+ * The pieces of a sub-grammar are joined into one NFA, which is then determinised */
+struct TokenNfa {
+    std::vector<std::vector<std::pair<int, int>>> edges; // (token ID, next state) for each state
+
+    int addState() {
+        edges.emplace_back();
+        return edges.size() - 1;
+    }
+};
+
+// Check if DFA state is dead (not accepting, and cannot be left)
+static bool isDead(const TokenDfa& dfa, int state) {
+    if (dfa.accept[state])
+        return false;
+    for (int next : dfa.next[state]) {
+        if (next != state)
+            return false;
+    }
+    return true;
+}
+
+/* Add copy of DFA to NFA, entered from state "from", and left from accepting states to
+ * state "to" */
+static void embedDfa(TokenNfa& nfa, const TokenDfa& dfa, int from, int to) {
+    int offset = nfa.edges.size();
+    for (size_t state = 0; state < dfa.accept.size(); state++)
+        nfa.addState();
+
+    nfa.edges[from].push_back({-1, offset});
+    for (size_t state = 0; state < dfa.accept.size(); state++) {
+        if (dfa.accept[state])
+            nfa.edges[offset + state].push_back({-1, to});
+        for (size_t id = 0; id < classCount; id++) {
+            int next = dfa.next[state][id];
+            if (!isDead(dfa, next))
+                nfa.edges[offset + state].push_back({(int)id, offset + next});
+        }
+    }
+}
+
+// Add states reachable by epsilon transitions to set of NFA states
+static void epsilonClosure(const TokenNfa& nfa, std::set<int>& states) {
+    std::vector<int> toVisit(states.cbegin(), states.cend());
+    while (!toVisit.empty()) {
+        int state = toVisit.back();
+        toVisit.pop_back();
+        for (const auto& edge : nfa.edges[state]) {
+            if ((edge.first < 0) && states.insert(edge.second).second)
+                toVisit.push_back(edge.second);
+        }
+    }
+}
+
+/* Minimise DFA by partition refinement: states are split by whether they are accepting,
+ * then by the blocks their transitions lead to, until no block is split
+ * Blocks are numbered in order of their first state, so the start state stays 0 */
+static TokenDfa minimise(const TokenDfa& dfa) {
+    std::vector<int> blocks(dfa.accept.size(), 0);
+    for (size_t state = 0; state < blocks.size(); state++)
+        blocks[state] = dfa.accept[state];
+
+    size_t blockCount = 0;
+    while (true) {
+        std::map<std::vector<int>, int> blockNos; // number of each block, by signature
+        std::vector<int> newBlocks(blocks.size());
+        for (size_t state = 0; state < blocks.size(); state++) {
+            std::vector<int> signature = {blocks[state]};
+            for (int next : dfa.next[state])
+                signature.push_back(blocks[next]);
+            newBlocks[state] = blockNos.emplace(signature, blockNos.size()).first->second;
+        }
+        blocks = newBlocks;
+
+        if (blockNos.size() == blockCount)
+            break; // no block was split
+        blockCount = blockNos.size();
+    }
+
+    TokenDfa minDfa;
+    minDfa.next.resize(blockCount, std::vector<int>(classCount));
+    minDfa.accept.resize(blockCount);
+    for (size_t state = 0; state < blocks.size(); state++) {
+        minDfa.accept[blocks[state]] = dfa.accept[state];
+        for (size_t id = 0; id < classCount; id++)
+            minDfa.next[blocks[state]][id] = blocks[dfa.next[state][id]];
+    }
+    return minDfa;
+}
+
+/* Convert NFA to minimised DFA by subset construction, starting from state "start" and
+ * accepting at state "final"
+ * Fails if DFA has too many states */
+static std::optional<TokenDfa> determinise(const TokenNfa& nfa, int start, int final) {
+    std::set<int> startStates = {start};
+    epsilonClosure(nfa, startStates);
+    std::vector<std::set<int>> subsets = {startStates};
+    std::map<std::set<int>, int> stateNos = {{startStates, 0}};
+
+    TokenDfa dfa;
+    for (size_t i = 0; i < subsets.size(); i++) {
+        if (subsets.size() > maxStates)
+            return std::nullopt;
+
+        std::vector<std::set<int>> nextSets(classCount);
+        for (int state : subsets[i]) {
+            for (const auto& edge : nfa.edges[state]) {
+                if (edge.first >= 0)
+                    nextSets[edge.first].insert(edge.second);
+            }
+        }
+
+        dfa.accept.push_back(subsets[i].count(final) > 0);
+        dfa.next.emplace_back();
+        for (std::set<int>& nextSet : nextSets) {
+            epsilonClosure(nfa, nextSet);
+            auto found = stateNos.emplace(nextSet, subsets.size());
+            if (found.second)
+                subsets.push_back(nextSet);
+            dfa.next.back().push_back(found.first->second);
+        }
+    }
+    return minimise(dfa);
+}
+
+/* Intersect two DFAs by product construction (only reachable pairs of states)
+ * Fails if DFA has too many states */
+static std::optional<TokenDfa> intersect(const TokenDfa& a, const TokenDfa& b) {
+    std::vector<std::pair<int, int>> pairs = {{0, 0}};
+    std::map<std::pair<int, int>, int> stateNos = {{{0, 0}, 0}};
+
+    TokenDfa dfa;
+    for (size_t i = 0; i < pairs.size(); i++) {
+        if (pairs.size() > maxStates)
+            return std::nullopt;
+
+        auto [stateA, stateB] = pairs[i];
+        dfa.accept.push_back(a.accept[stateA] && b.accept[stateB]);
+        dfa.next.emplace_back();
+        for (size_t id = 0; id < classCount; id++) {
+            std::pair<int, int> nextPair = {a.next[stateA][id], b.next[stateB][id]};
+            auto found = stateNos.emplace(nextPair, pairs.size());
+            if (found.second)
+                pairs.push_back(nextPair);
+            dfa.next.back().push_back(found.first->second);
+        }
+    }
+    return minimise(dfa);
+}
+
+// Complement DFA (accept exactly the sequences it rejects)
+static TokenDfa complement(TokenDfa dfa) {
+    for (size_t state = 0; state < dfa.accept.size(); state++)
+        dfa.accept[state] = !dfa.accept[state];
+    return dfa;
+}
+
+// DFA accepting every sequence
+static TokenDfa allDfa() {
+    TokenDfa dfa;
+    dfa.next.push_back(std::vector<int>(classCount, 0));
+    dfa.accept.push_back(true);
+    return dfa;
+}
+
+// Build DFA accepting exactly the given sequences (padding is skipped)
+TokenDfa sequenceDfa(const SeqSet& seqs) {
+    TokenDfa trie; // trie of sequences; state 0 is the root, and state 1 is dead
+    trie.next = {std::vector<int>(classCount, 1), std::vector<int>(classCount, 1)};
+    trie.accept = {false, false};
+
+    seqs.forEach([&](const StrVec& v) {
+        int state = 0;
+        for (const std::string& term : v) {
+            if (term == "")
+                continue;
+            int& next = trie.next[state][classIds[term]];
+            if (next == 1) {
+                next = trie.accept.size();
+                trie.next.push_back(std::vector<int>(classCount, 1));
+                trie.accept.push_back(false);
+            }
+            state = trie.next[state][classIds[term]];
+        }
+        trie.accept[state] = true;
+    });
+    return minimise(trie);
+}
+
+//-------------------------------//
+// Compile Regular Non-Terminals //
+//-------------------------------//
+
+/* Add path for a sequence of symbols to NFA, from state "from" to state "final"
+ * Terminals become single transitions (one per character, if compiling by character),
+ * and compiled non-terminals become copies of their
+ * DFAs; a non-terminal being compiled along with this one (entries) may only be the last
+ * symbol, and becomes an epsilon transition to its entry state (right-linear recursion)
+ * Returns false if sequence cannot be compiled */
+static bool addSymbols(TokenNfa& nfa, const SymbVec& symbols, int from, int final, const std::map<std::string, int>& entries) {
+    int state = from;
+    for (size_t i = 0; i < symbols.size(); i++) {
+        const SYMBOL& symb = symbols[i];
+        if (symb.type == LITERAL) {
+            std::vector<int> ids = {classIds[symb.str]};
+            if (byCharacter) {
+                ids.clear();
+                for (unsigned char c : symb.str)
+                    ids.push_back(c);
+            }
+            for (int id : ids) {
+                int next = nfa.addState();
+                nfa.edges[state].push_back({id, next});
+                state = next;
+            }
+        } else if ((symb.type == NON_TERM) && (entries.count(symb.str) > 0)) {
+            for (size_t j = i + 1; j < symbols.size(); j++) {
+                if (symbols[j].type != EPSILON)
+                    return false; // recursion is not right-linear
+            }
+            nfa.edges[state].push_back({-1, entries.at(symb.str)});
+            return true;
+        } else if (symb.type == NON_TERM) {
+            if (compiled->count(symb.str) == 0)
+                return false; // non-terminal could not be compiled
+            int next = nfa.addState();
+            embedDfa(nfa, compiled->at(symb.str), state, next);
+            state = next;
+        }
+    }
+    nfa.edges[state].push_back({-1, final});
+    return true;
+}
+
+/* Compile rule to DFA: intersection of positive conjuncts' DFAs and complements of
+ * negative conjuncts' DFAs (conjuncts may only use compiled non-terminals) */
+static std::optional<TokenDfa> ruleDfa(const GNodeList& conjList) {
+    TokenDfa dfa = allDfa();
+    for (const GNode& conj : conjList) {
+        TokenNfa nfa;
+        int start = nfa.addState();
+        int final = nfa.addState();
+        if (!addSymbols(nfa, conj->getSymbols(), start, final, {}))
+            return std::nullopt;
+
+        std::optional<TokenDfa> conjDfa = determinise(nfa, start, final);
+        if (!conjDfa)
+            return std::nullopt;
+        conjDfa = intersect(dfa, conj->isPositive() ? *conjDfa : complement(*conjDfa));
+        if (!conjDfa)
+            return std::nullopt;
+        dfa = *conjDfa;
+    }
+    return dfa;
+}
+
+/* Compile strongly connected component of non-terminals to DFAs, if its recursion is
+ * right-linear and everything else it uses has been compiled
+ * Single positive conjuncts are joined into one NFA, where recursion becomes epsilon
+ * transitions; other rules must not refer back to the component, and are compiled to DFAs
+ * by product and complement constructions */
+static void compileComponent(const std::map<std::string, GNode>& grammar, const StrVec& component) {
+    for (const std::string& nt : component) {
+        if (ntTypes.count(nt) > 0)
+            return; // value is computed by semantic actions, so rules must be parsed
+    }
+
+    TokenNfa nfa;
+    int final = nfa.addState();
+    std::map<std::string, int> entries; // entry state of each non-terminal
+    for (const std::string& nt : component)
+        entries[nt] = nfa.addState();
+
+    for (const std::string& nt : component) {
+        for (const GNode& rule : grammar.at(nt)->getChildren()) {
+            GNodeList conjList = rule->getChildren();
+            if ((conjList.size() == 1) && conjList[0]->isPositive()) {
+                if (!addSymbols(nfa, conjList[0]->getSymbols(), entries[nt], final, entries))
+                    return;
+            } else {
+                std::optional<TokenDfa> dfa = ruleDfa(conjList);
+                if (!dfa)
+                    return;
+                embedDfa(nfa, *dfa, entries[nt], final);
+            }
+        }
+    }
+
+    std::map<std::string, TokenDfa> dfas;
+    for (const std::string& nt : component) {
+        std::optional<TokenDfa> dfa = determinise(nfa, entries[nt], final);
+        if (!dfa)
+            return;
+        dfas[nt] = *dfa;
+    }
+    compiled->insert(dfas.cbegin(), dfas.cend());
+}
+
+// State of Tarjan's algorithm for strongly connected components
+static std::map<std::string, int> visitNos, lowNos;
+static StrVec ntStack;
+static StrSet onStack;
+
+/* Find strongly connected components by depth-first search, and compile each one as soon
+ * as it is found, after every component it refers to */
+static void findComponents(const std::map<std::string, GNode>& grammar, const std::string& nt) {
+    visitNos[nt] = lowNos[nt] = visitNos.size();
+    ntStack.push_back(nt);
+    onStack.insert(nt);
+
+    for (const std::string& ref : grammar.at(nt)->references()) {
+        if (grammar.count(ref) == 0)
+            continue;
+        if (visitNos.count(ref) == 0) {
+            findComponents(grammar, ref);
+            lowNos[nt] = std::min(lowNos[nt], lowNos[ref]);
+        } else if (onStack.count(ref) > 0) {
+            lowNos[nt] = std::min(lowNos[nt], visitNos[ref]);
+        }
+    }
+
+    if (lowNos[nt] == visitNos[nt]) {
+        StrVec component;
+        std::string member;
+        do {
+            member = ntStack.back();
+            ntStack.pop_back();
+            onStack.erase(member);
+            component.push_back(member);
+        } while (member != nt);
+        compileComponent(grammar, component);
+    }
+}
+
+// Compile every non-terminal that can be compiled into dfas
+static void compileAll(const std::map<std::string, GNode>& grammar, std::map<std::string, TokenDfa>& dfas) {
+    compiled = &dfas;
+    visitNos.clear();
+    lowNos.clear();
+    for (const auto& disj : grammar) {
+        if (visitNos.count(disj.first) == 0)
+            findComponents(grammar, disj.first);
+    }
+}
+
+/* Compile each non-terminal whose sub-grammar is regular to a minimised DFA over token
+ * IDs, unless a DFA built on the way has more than stateLimit states
+ * Token IDs are numbered in alphabetical order of class representatives, as in the
+ * generated lexer */
+void compileRegularNts(const std::map<std::string, GNode>& grammar, size_t stateLimit) {
+    std::set<std::string> reps;
+    for (const auto& term : terminalClasses)
+        reps.insert(term.second);
+    for (const std::string& rep : reps)
+        classIds.emplace(rep, classIds.size());
+    classCount = classIds.size();
+    maxStates = stateLimit;
+    byCharacter = false;
+    compileAll(grammar, regularDfas);
+}
+
+//-----------------//
+// Compound Tokens //
+//-----------------//
+
+// Get set of terminals used in definition of non-terminal
+static StrSet definitionTerminals(const GNode& disj) {
+    StrSet terms;
+    for (const GNode& rule : disj->getChildren()) {
+        for (const GNode& conj : rule->getChildren()) {
+            for (const SYMBOL& symb : conj->getSymbols()) {
+                if (symb.type == LITERAL)
+                    terms.insert(symb.str);
+            }
+        }
+    }
+    return terms;
+}
+
+/* Get set of non-terminals reachable from roots (including roots), without going past
+ * the non-terminals in stops, which are added to reached instead */
+static StrSet reachableNts(const std::map<std::string, GNode>& grammar, const StrSet& roots, const StrSet& stops, StrSet& reached) {
+    StrSet visited = roots;
+    StrVec toVisit(roots.cbegin(), roots.cend());
+    while (!toVisit.empty()) {
+        std::string current = toVisit.back();
+        toVisit.pop_back();
+        for (const std::string& ref : grammar.at(current)->references()) {
+            if (grammar.count(ref) == 0)
+                continue;
+            if (stops.count(ref) > 0)
+                reached.insert(ref);
+            else if (visited.insert(ref).second)
+                toVisit.push_back(ref);
+        }
+    }
+    return visited;
+}
+
+// Check if two DFAs accept a common sequence (assumed if their product is too large)
+static bool overlaps(const TokenDfa& a, const TokenDfa& b) {
+    std::optional<TokenDfa> both = intersect(a, b);
+    return !both || std::find((both->accept).cbegin(), (both->accept).cend(), true) != (both->accept).cend();
+}
+
+/* Replace non-terminals that are referenced by the rest of the grammar, and whose
+ * sub-grammars are regular over single-character terminals, with compound tokens
+ * recognised by the generated lexer (e.g. identifiers and numbers spelt out one character
+ * at a time)
+ * A non-terminal is only lifted if it is written in the grammar (not made for an EBNF
+ * operator) without precedence levels, its language is non-empty and does not contain the empty string, its
+ * terminals are not used outside lifted non-terminals, it does not contain another
+ * lifted non-terminal (the inner one is lifted instead), and no other lifted
+ * non-terminal shares a string with it, so the lexer never has to choose between
+ * the parser's readings of the same characters; these are checked again each time a
+ * non-terminal is dropped, until none is
+ * The token of a lifted non-terminal N is named "<N>", and its DFA over characters is
+ * added to compoundTokens; non-terminals only used by lifted non-terminals are removed
+ * Returns grammar with the lifted non-terminals as terminals */
+std::map<std::string, GNode> liftCompoundTokens(const std::map<std::string, GNode>& grammar, const std::string& startSymbol, size_t stateLimit) {
+    std::map<std::string, TokenDfa> characterDfas;
+    classCount = 256;
+    maxStates = stateLimit;
+    byCharacter = true;
+    compileAll(grammar, characterDfas);
+
+    /* Non-terminals not reachable from the start symbol are left as they are, but what they
+     * use is kept */
+    StrSet ignored;
+    StrSet startNts = reachableNts(grammar, {startSymbol}, {}, ignored);
+    StrSet roots = {startSymbol};
+    for (const auto& disj : grammar) {
+        if (startNts.count(disj.first) == 0)
+            roots.insert(disj.first);
+    }
+
+    // Non-terminals in sub-grammar of each compiled non-terminal, and terminals they use
+    std::map<std::string, StrSet> subNts, subTerms;
+    StrSet candidates;
+    for (const auto& dfa : characterDfas) {
+        subNts[dfa.first] = reachableNts(grammar, {dfa.first}, {}, ignored);
+        for (const std::string& member : subNts[dfa.first]) {
+            StrSet terms = definitionTerminals(grammar.at(member));
+            subTerms[dfa.first].insert(terms.cbegin(), terms.cend());
+        }
+
+        const std::vector<bool>& accept = (dfa.second).accept;
+        bool nonEmpty = std::find(accept.cbegin(), accept.cend(), true) != accept.cend();
+        bool characters = std::all_of(subTerms[dfa.first].cbegin(), subTerms[dfa.first].cend(), [](const std::string& term) {
+            return term.length() == 1;
+        });
+        if ((dfa.first != startSymbol) && (ebnfNts.count(dfa.first) == 0) && (operatorLevels.count(dfa.first) == 0) && (operatorHelpers.count(dfa.first) == 0) && (startNts.count(dfa.first) > 0) && nonEmpty && !accept[0] && characters && (alphabet.count("<" + dfa.first + ">") == 0))
+            candidates.insert(dfa.first);
+    }
+
+    // Drop candidates that break the conditions, until every lifted non-terminal meets them
+    StrSet lifted, kept;
+    while (true) {
+        lifted.clear();
+        kept = reachableNts(grammar, roots, candidates, lifted);
+
+        StrSet keptTerms;
+        for (const std::string& nt : kept) {
+            StrSet terms = definitionTerminals(grammar.at(nt));
+            keptTerms.insert(terms.cbegin(), terms.cend());
+        }
+
+        StrSet dropped;
+        for (const std::string& nt : lifted) {
+            for (const std::string& term : subTerms[nt]) {
+                if (keptTerms.count(term) > 0)
+                    dropped.insert(nt);
+            }
+            for (const std::string& other : lifted) {
+                if ((other != nt) && (subNts[nt].count(other) > 0)) {
+                    dropped.insert(nt);
+                } else if ((other < nt) && (subNts[other].count(nt) == 0) && overlaps(characterDfas[nt], characterDfas[other])) {
+                    dropped.insert(nt);
+                    dropped.insert(other);
+                }
+            }
+        }
+        if (dropped.empty())
+            break;
+        for (const std::string& nt : dropped)
+            candidates.erase(nt);
+    }
+
+    // Rebuild grammar without lifted non-terminals and those only reachable through them
+    std::map<std::string, GNode> liftedGrammar;
+    alphabet.clear();
+    for (const auto& disj : grammar) {
+        if (kept.count(disj.first) == 0)
+            continue;
+
+        GNodeList ruleList;
+        for (const GNode& rule : disj.second->getChildren()) {
+            GNodeList conjList;
+            for (const GNode& conj : rule->getChildren()) {
+                SymbVec symbols = conj->getSymbols();
+                for (SYMBOL& symb : symbols) {
+                    if ((symb.type == NON_TERM) && (lifted.count(symb.str) > 0)) {
+                        symb.type = LITERAL;
+                        symb.str = "<" + symb.str + ">";
+                    }
+                    if (symb.type == LITERAL)
+                        alphabet.insert(symb.str);
+                }
+                conjList.push_back(std::make_shared<Conjunct>(symbols, conj->isPositive(), conj->getAction()));
+            }
+            ruleList.push_back(std::make_shared<Rule>(conjList));
+        }
+        liftedGrammar[disj.first] = std::make_shared<Disj>(ruleList);
+    }
+
+    for (const std::string& nt : lifted)
+        compoundTokens["<" + nt + ">"] = characterDfas[nt];
+    return liftedGrammar;
+}
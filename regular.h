@@ -0,0 +1,21 @@
+#pragma once
+#ifndef REGULAR_H
+#define REGULAR_H
+
+/* DFA over token IDs (terminal classes)
+ * State 0 is the start state, and every state has a transition for every class, so a DFA
+ * is complemented by flipping its accepting states */
+struct TokenDfa {
+    std::vector<std::vector<int>> next; // next state, for each state and class
+    std::vector<bool> accept;           // whether each state is accepting
+};
+
+extern std::map<std::string, TokenDfa> regularDfas;    // DFA of each compiled non-terminal
+extern std::map<std::string, TokenDfa> followDfas;     // DFA of PFOLLOW set of each compiled non-terminal
+extern std::map<std::string, TokenDfa> compoundTokens; // DFA over characters of each compound token
+
+void compileRegularNts(const std::map<std::string, GNode>& grammar, size_t stateLimit);
+std::map<std::string, GNode> liftCompoundTokens(const std::map<std::string, GNode>& grammar, const std::string& startSymbol, size_t stateLimit);
+TokenDfa sequenceDfa(const SeqSet& seqs); // DFA accepting exactly the given sequences
+
+#endif
@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <unistd.h>
+#include "grammar.h"
+
+//---------------------------//
+// Packed Sequence Encoding //
+//---------------------------//
+
+/* A packed sequence is k terminal IDs, padded with 0
+ * IDs start from 1 and follow alphabetical order of terminals, and epsilon is all 0s, so
+ * packed sequences sort in the same order as the vectors of strings they represent */
+using Packed = std::vector<uint32_t>;
+
+static size_t width = 1;                        // k, number of IDs in packed sequence
+static size_t spillLimit = 1 << 20;             // most sequences a set holds in memory
+static std::map<std::string, uint32_t> termIds; // ID of each terminal
+static StrVec idTerms = {""};                   // terminal for each ID
+
+// Set terminal IDs, sequence length and spill limit (before computing any sets)
+void initSeqSets(const StrSet& alphabet, int k, size_t limit) {
+    width = k;
+    spillLimit = limit;
+    termIds.clear();
+    idTerms = {""};
+    for (const std::string& s : alphabet) {
+        termIds[s] = idTerms.size();
+        idTerms.push_back(s);
+    }
+}
+
+// Convert sequence of terminals to packed sequence
+static void encode(const StrVec& seq, uint32_t *packed) {
+    std::fill(packed, packed + width, 0);
+    size_t i = 0;
+    for (const std::string& s : seq) {
+        if (s != "")
+            packed[i++] = termIds.at(s);
+    }
+}
+
+// Convert packed sequence to sequence of terminals
+static StrVec decode(const uint32_t *packed) {
+    StrVec seq;
+    for (size_t i = 0; (i < width) && (packed[i] != 0); i++)
+        seq.push_back(idTerms[packed[i]]);
+    if (seq.empty())
+        seq.push_back(""); // epsilon
+    return seq;
+}
+
+static bool packedLess(const uint32_t *a, const uint32_t *b) {
+    return std::lexicographical_compare(a, a + width, b, b + width);
+}
+
+static bool packedEqual(const uint32_t *a, const uint32_t *b) {
+    return std::equal(a, a + width, b);
+}
+
+//---------------------//
+// Sorted Runs on Disk //
+//---------------------//
+
+// Sorted run of distinct packed sequences, in a temporary file
+class SeqRun {
+    FILE *File;
+    std::vector<uint32_t> Buffer; // packed sequences not yet written
+
+    public:
+        size_t Count = 0;
+
+        SeqRun(): File(tmpfile()) {
+            if (File == NULL) {
+                std::cout << "Error creating temporary file for PFIRST/PFOLLOW set\n";
+                exit(1);
+            }
+        }
+        ~SeqRun() {fclose(File);}
+
+        // Add packed sequence to end of run
+        void append(const uint32_t *packed) {
+            Buffer.insert(Buffer.end(), packed, packed + width);
+            Count++;
+            if (Buffer.size() >= (1 << 16))
+                flush();
+        }
+
+        void flush() {
+            if (fwrite(Buffer.data(), sizeof(uint32_t), Buffer.size(), File) != Buffer.size()) {
+                std::cout << "Error writing temporary file for PFIRST/PFOLLOW set\n";
+                exit(1);
+            }
+            fflush(File);
+            Buffer.clear();
+        }
+
+        /* Read packed sequences, starting from given index
+         * pread does not move a shared file position, so threads can read the same run; it
+         * may read less than asked, so it is repeated for the rest */
+        size_t read(size_t index, size_t n, uint32_t *dest) const {
+            n = std::min(n, Count - index);
+            size_t done = 0, length = n * width * sizeof(uint32_t);
+            while (done < length) {
+                ssize_t got = pread(fileno(File), (char *) dest + done, length - done, index * width * sizeof(uint32_t) + done);
+                if (got <= 0) {
+                    std::cout << "Error reading temporary file for PFIRST/PFOLLOW set\n";
+                    exit(1);
+                }
+                done += got;
+            }
+            return n;
+        }
+};
+
+// Reads sequences of a set in sorted order, as packed sequences
+class SeqReader {
+    const SeqSet& Set;
+    std::set<StrVec>::const_iterator It;
+    std::vector<uint32_t> Buffer; // packed sequences read from run
+    size_t Index = 0, BufferStart = 0, BufferCount = 0;
+
+    public:
+        SeqReader(const SeqSet& set): Set(set), It(set.Seqs.cbegin()), Buffer(std::max<size_t>(width, 1 << 16)) {}
+
+        // Get next packed sequence (NULL at end); valid until next call
+        const uint32_t *next() {
+            if (!Set.Run) {
+                if (It == Set.Seqs.cend())
+                    return NULL;
+                encode(*It++, Buffer.data());
+                return Buffer.data();
+            }
+
+            if (Index == BufferStart + BufferCount) {
+                if (Index == Set.Run->Count)
+                    return NULL;
+                BufferStart = Index;
+                BufferCount = Set.Run->read(Index, Buffer.size() / width, Buffer.data());
+            }
+            return Buffer.data() + (Index++ - BufferStart) * width;
+        }
+};
+
+/* Builds set from packed sequences given in sorted order (repeats are skipped)
+ * Sequences are kept packed in memory until there are more than the spill limit, then
+ * they are written to a run on disk */
+class SeqSetBuilder {
+    std::vector<uint32_t> Pending; // packed sequences, while in memory
+    std::shared_ptr<SeqRun> Run;
+    Packed Last;
+    size_t Count = 0;
+
+    public:
+        void append(const uint32_t *packed) {
+            if ((Count > 0) && packedEqual(packed, Last.data()))
+                return;
+            Last.assign(packed, packed + width);
+            Count++;
+
+            if (Run) {
+                Run->append(packed);
+                return;
+            }
+            Pending.insert(Pending.end(), packed, packed + width);
+            if (Count > spillLimit) {
+                Run = std::make_shared<SeqRun>();
+                for (size_t i = 0; i < Count; i++)
+                    Run->append(Pending.data() + i * width);
+                Pending = std::vector<uint32_t>();
+            }
+        }
+
+        SeqSet finish() {
+            SeqSet result;
+            if (Run) {
+                Run->flush();
+                result.Run = Run;
+            } else {
+                for (size_t i = 0; i < Count; i++)
+                    result.Seqs.insert(result.Seqs.cend(), decode(Pending.data() + i * width));
+            }
+            return result;
+        }
+};
+
+//---------------------//
+// Set of Sequences    //
+//---------------------//
+
+size_t SeqSet::size() const {
+    return Run ? Run->Count : Seqs.size();
+}
+
+// Check if set contains sequence (binary search, if set is on disk)
+bool SeqSet::contains(const StrVec& seq) const {
+    if (!Run)
+        return Seqs.contains(seq);
+
+    Packed packed(width), current(width);
+    encode(seq, packed.data());
+    size_t low = 0, high = Run->Count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        Run->read(mid, 1, current.data());
+        if (packedLess(current.data(), packed.data()))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == Run->Count)
+        return false;
+    Run->read(low, 1, current.data());
+    return packedEqual(current.data(), packed.data());
+}
+
+// Move set to disk if it has become too large for memory
+void SeqSet::spillIfLarge() {
+    if (Run || (Seqs.size() <= spillLimit))
+        return;
+
+    SeqSetBuilder builder;
+    SeqReader reader(*this);
+    while (const uint32_t *packed = reader.next())
+        builder.append(packed);
+    *this = builder.finish();
+}
+
+void SeqSet::insert(const StrVec& seq) {
+    if (!Run) {
+        Seqs.insert(seq);
+        spillIfLarge();
+        return;
+    }
+    SeqSet single;
+    single.Seqs.insert(seq);
+    insert(single);
+}
+
+// Add all sequences of another set (merge, if either set is on disk)
+void SeqSet::insert(const SeqSet& seqs) {
+    if (!Run && !seqs.Run) {
+        Seqs.insert(seqs.Seqs.cbegin(), seqs.Seqs.cend());
+        spillIfLarge();
+        return;
+    }
+
+    SeqSetBuilder builder;
+    SeqReader readerA(*this), readerB(seqs);
+    const uint32_t *a = readerA.next(), *b = readerB.next();
+    while (a || b) {
+        if (!b || (a && packedLess(a, b))) {
+            builder.append(a);
+            a = readerA.next();
+        } else {
+            builder.append(b);
+            if (a && packedEqual(a, b))
+                a = readerA.next();
+            b = readerB.next();
+        }
+    }
+    *this = builder.finish();
+}
+
+// Call function on each sequence in set, in sorted order
+void SeqSet::forEach(const std::function<void(const StrVec&)>& fn) const {
+    if (!Run) {
+        for (const StrVec& seq : Seqs)
+            fn(seq);
+        return;
+    }
+    SeqReader reader(*this);
+    while (const uint32_t *packed = reader.next())
+        fn(decode(packed));
+}
+
+// Get sequences in both sets (or, if keep is false, in a but not b) by merging
+static SeqSet mergeFilter(const SeqSet& a, const SeqSet& b, bool keep) {
+    SeqSetBuilder builder;
+    SeqReader readerA(a), readerB(b);
+    const uint32_t *seqA = readerA.next(), *seqB = readerB.next();
+    while (seqA) {
+        if (!seqB || packedLess(seqA, seqB)) {
+            if (!keep)
+                builder.append(seqA);
+            seqA = readerA.next();
+        } else if (packedLess(seqB, seqA)) {
+            seqB = readerB.next();
+        } else {
+            if (keep)
+                builder.append(seqA);
+            seqA = readerA.next();
+            seqB = readerB.next();
+        }
+    }
+    return builder.finish();
+}
+
+SeqSet setIntersection(const SeqSet& a, const SeqSet& b) {
+    if (a.Run || b.Run)
+        return mergeFilter(a, b, true);
+
+    SeqSet result;
+    for (const StrVec& seq : a.Seqs) {
+        if (b.Seqs.contains(seq))
+            result.Seqs.insert(result.Seqs.cend(), seq);
+    }
+    return result;
+}
+
+SeqSet setDifference(const SeqSet& a, const SeqSet& b) {
+    if (a.Run || b.Run)
+        return mergeFilter(a, b, false);
+
+    SeqSet result;
+    for (const StrVec& seq : a.Seqs) {
+        if (!b.Seqs.contains(seq))
+            result.Seqs.insert(result.Seqs.cend(), seq);
+    }
+    return result;
+}
+
+//-----------------------------//
+// Concatenation of Sequences //
+//-----------------------------//
+
+/* Sort packed sequences in buffer, and write them (without repeats) to a new run
+ * Runs are wrapped in sets, so they can be read with SeqReader */
+static SeqSet sortedRun(std::vector<uint32_t>& buffer) {
+    size_t count = buffer.size() / width;
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+        return packedLess(buffer.data() + x * width, buffer.data() + y * width);
+    });
+
+    SeqSetBuilder builder;
+    for (size_t i : order)
+        builder.append(buffer.data() + i * width);
+    buffer.clear();
+    return builder.finish();
+}
+
+/* Concatenate each sequence in set "seqs" with each sequence in set "addSeqs"
+ * Truncate each resulting sequence to k symbols, and add it to new set
+ * Return this new set
+ * If there may be more results than the spill limit, results are collected in a buffer of
+ * at most that many sequences; each full buffer is sorted into a run, and the runs are
+ * merged into the new set at the end */
+SeqSet allConcat(const SeqSet& seqs, const SeqSet& addSeqs, int k) {
+    if (seqs.empty())
+        return addSeqs;
+
+    // Small sets: concatenate sequences of strings directly
+    if (!seqs.Run && !addSeqs.Run && (seqs.size() * addSeqs.size() <= spillLimit)) {
+        SeqSet newSeqs;
+        for (StrVec v : seqs.Seqs) {
+            for (const StrVec& vec : addSeqs.Seqs) {
+                StrVec newV = v;
+                newV.erase(std::remove(newV.begin(), newV.end(), ""), newV.end());
+                size_t i = 0;
+                while ((newV.size() < (size_t)k) && (i < vec.size())) {
+                    if (vec[i] != "")
+                        newV.push_back(vec[i]);
+                    i++;
+                }
+                if (newV.empty())
+                    newV.push_back("");
+                newSeqs.Seqs.insert(newV);
+            }
+        }
+        newSeqs.spillIfLarge();
+        return newSeqs;
+    }
+
+    std::vector<SeqSet> runs;
+    std::vector<uint32_t> buffer;
+    Packed newSeq(width);
+    SeqReader reader(seqs);
+    while (const uint32_t *v = reader.next()) {
+        size_t vLen = std::find(v, v + width, 0) - v;
+        SeqReader addReader(addSeqs);
+        while (const uint32_t *vec = addReader.next()) {
+            std::copy(v, v + width, newSeq.begin());
+            for (size_t i = 0; (vLen + i < width) && (vec[i] != 0); i++)
+                newSeq[vLen + i] = vec[i];
+            buffer.insert(buffer.end(), newSeq.cbegin(), newSeq.cend());
+            if (buffer.size() / width >= spillLimit)
+                runs.push_back(sortedRun(buffer));
+        }
+    }
+    if (runs.empty())
+        return sortedRun(buffer);
+    if (!buffer.empty())
+        runs.push_back(sortedRun(buffer));
+
+    // Merge runs, taking smallest next sequence each time
+    std::vector<SeqReader> readers(runs.cbegin(), runs.cend());
+    std::vector<const uint32_t *> heads;
+    auto greater = [&](size_t x, size_t y) {return packedLess(heads[y], heads[x]);};
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> queue(greater);
+    for (size_t i = 0; i < readers.size(); i++) {
+        heads.push_back(readers[i].next());
+        if (heads[i])
+            queue.push(i);
+    }
+
+    SeqSetBuilder builder;
+    while (!queue.empty()) {
+        size_t i = queue.top();
+        queue.pop();
+        builder.append(heads[i]);
+        if ((heads[i] = readers[i].next()))
+            queue.push(i);
+    }
+    return builder.finish();
+}
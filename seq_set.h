@@ -0,0 +1,42 @@
+#pragma once
+#ifndef SEQ_SET_H
+#define SEQ_SET_H
+
+#include <functional>
+#include <memory>
+#include <set>
+
+class SeqRun;
+
+/* Set of sequences of terminals (PFIRST/PFOLLOW sets)
+ * Kept in memory while it is small; once it holds more than the spill limit, it is moved
+ * to a sorted run of packed sequences (terminal IDs) in a temporary file, and operations
+ * on it stream through the file instead */
+class SeqSet {
+    std::set<StrVec> Seqs;       // sequences, if set is in memory
+    std::shared_ptr<SeqRun> Run; // sequences, if set is on disk (never modified once written)
+
+    void spillIfLarge();
+
+    public:
+        SeqSet() {}
+        size_t size() const;
+        bool empty() const {return size() == 0;};
+        bool contains(const StrVec& seq) const;
+        void insert(const StrVec& seq);
+        void insert(const SeqSet& seqs);
+        void forEach(const std::function<void(const StrVec&)>& fn) const;
+
+        friend class SeqReader;
+        friend class SeqSetBuilder;
+        friend SeqSet setIntersection(const SeqSet& a, const SeqSet& b);
+        friend SeqSet setDifference(const SeqSet& a, const SeqSet& b);
+        friend SeqSet allConcat(const SeqSet& seqs, const SeqSet& addSeqs, int k);
+};
+
+void initSeqSets(const StrSet& alphabet, int k, size_t limit); // set terminal IDs, k and spill limit
+SeqSet setIntersection(const SeqSet& a, const SeqSet& b);      // sequences in both sets
+SeqSet setDifference(const SeqSet& a, const SeqSet& b);        // sequences in a but not b
+SeqSet allConcat(const SeqSet& seqs, const SeqSet& addSeqs, int k);
+
+#endif
@@ -0,0 +1,345 @@
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "grammar.h"
+#include "input_parser.h"
+#include "server.h"
+
+/* Requests are sent over a Unix domain socket as a line holding k and the options,
+ * followed by the contents of the grammar file
+ * Responses start with a line holding the exit status and the lengths of the report
+ * (what the generator prints) and the parser code, followed by the report and code */
+
+//-----------------//
+// Socket Handling //
+//-----------------//
+
+// Read from file descriptor until end of file
+static std::string readAll(int fd) {
+    std::string result = "";
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        result.append(buffer, n);
+    return result;
+}
+
+// Write whole string to file descriptor
+static bool writeAll(int fd, const std::string& str) {
+    size_t written = 0;
+    while (written < str.length()) {
+        ssize_t n = write(fd, str.data() + written, str.length() - written);
+        if (n <= 0)
+            return false;
+        written += n;
+    }
+    return true;
+}
+
+// Read whole contents of file, from the start
+static std::string readFile(FILE *file) {
+    std::string result = "";
+    char buffer[65536];
+    size_t n;
+    rewind(file);
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        result.append(buffer, n);
+    return result;
+}
+
+// Make address of socket at given path
+static bool socketAddress(const std::string& socketPath, sockaddr_un& addr) {
+    addr = sockaddr_un();
+    addr.sun_family = AF_UNIX;
+    if (socketPath.length() >= sizeof(addr.sun_path)) {
+        std::cout << "Socket path is too long\n";
+        return false;
+    }
+    socketPath.copy(addr.sun_path, socketPath.length());
+    return true;
+}
+
+/* Write contents to file, only if they differ from what the file already holds
+ * Leaving an unchanged file alone keeps its modification time, so builds that depend on
+ * it are not redone; return true if file was written */
+bool writeIfChanged(std::string path, const std::string& contents) {
+    std::ifstream oldFile(path, std::ios::binary);
+    if (oldFile) {
+        std::ostringstream oldContents;
+        oldContents << oldFile.rdbuf();
+        if (oldContents.str() == contents)
+            return false;
+    }
+
+    std::ofstream newFile(path, std::ios::binary);
+    newFile << contents;
+    return true;
+}
+
+//--------//
+// Server //
+//--------//
+
+// Result of a generation request
+struct Result {
+    int status;
+    std::string report, code;
+};
+
+static const size_t maxCached = 64; // number of results kept between requests
+static const size_t maxCachedPFirstBytes = 256 << 20; // size of PFIRST sets kept between requests
+
+static std::deque<std::string> pFirstCacheOrder; // keys of PFIRST cache entries, oldest first
+static size_t pFirstCacheBytes = 0;
+
+/* Add the PFIRST sets a request computed (see pFirstCompute in main.cpp) to the cache,
+ * removing the oldest entries once it is over its size; an entry cut short (if the request
+ * was killed while writing it) is left out */
+static void keepPFirsts(const std::string& entries) {
+    size_t at = 0;
+    while (at < entries.length()) {
+        size_t keyLen, entryLen;
+        size_t headerEnd = entries.find('\n', at);
+        if ((headerEnd == std::string::npos) || (sscanf(entries.c_str() + at, "%zu %zu", &keyLen, &entryLen) != 2) || (entries.length() - headerEnd - 1 < keyLen + entryLen))
+            break;
+        std::string key = entries.substr(headerEnd + 1, keyLen);
+        if (pFirstCache.count(key) == 0) {
+            pFirstCache[key] = entries.substr(headerEnd + 1 + keyLen, entryLen);
+            pFirstCacheOrder.push_back(key);
+            pFirstCacheBytes += keyLen + entryLen;
+        }
+        at = headerEnd + 1 + keyLen + entryLen;
+    }
+    while (pFirstCacheBytes > maxCachedPFirstBytes) {
+        const std::string& oldest = pFirstCacheOrder.front();
+        pFirstCacheBytes -= oldest.length() + pFirstCache[oldest].length();
+        pFirstCache.erase(oldest);
+        pFirstCacheOrder.pop_front();
+    }
+}
+
+/* Run generator for request in a child process, so that errors in the grammar (which exit
+ * the generator) do not stop the server, and each request starts from a clean state
+ * The child starts with the server's PFIRST cache, and passes back the sets it computed, so
+ * requests for different versions of a grammar reuse the sets of its unedited parts */
+static Result runRequest(const StrVec& args, const std::string& grammarStr) {
+    Result result = {1, "", ""};
+    FILE *reportFile = tmpfile();
+    FILE *codeFile = tmpfile();
+    FILE *cacheFile = tmpfile();
+    if ((reportFile == NULL) || (codeFile == NULL) || (cacheFile == NULL)) {
+        result.report = "Error creating temporary files\n";
+        return result;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        pFirstCacheFile = cacheFile;
+        inpFile = tmpfile();
+        fwrite(grammarStr.data(), 1, grammarStr.length(), inpFile);
+        rewind(inpFile);
+        dup2(fileno(reportFile), STDOUT_FILENO); // report goes to temporary file
+
+        std::ostringstream parserCode;
+        int status = generate(args, parserCode);
+        std::string code = parserCode.str();
+        fwrite(code.data(), 1, code.length(), codeFile);
+        fflush(codeFile);
+        exit(status);
+    }
+
+    int childStatus;
+    if ((pid < 0) || (waitpid(pid, &childStatus, 0) < 0)) {
+        result.report = "Error running generator\n";
+    } else {
+        result.status = WIFEXITED(childStatus) ? WEXITSTATUS(childStatus) : 1;
+        result.report = readFile(reportFile);
+        result.code = readFile(codeFile);
+        keepPFirsts(readFile(cacheFile));
+    }
+    fclose(reportFile);
+    fclose(codeFile);
+    fclose(cacheFile);
+    return result;
+}
+
+/* Listen on socket and answer generation requests, one at a time
+ * Results are kept in memory, so repeating a request returns the same result without
+ * running the generator again */
+int runServer(const char *socketPath) {
+    sockaddr_un addr;
+    if (!socketAddress(socketPath, addr))
+        return 1;
+
+    /* Remove socket left by a previous server, but only if it is a socket (so that a mistyped
+     * path does not delete a file) and no server answers on it */
+    struct stat pathStat;
+    if (lstat(socketPath, &pathStat) == 0) {
+        if (!S_ISSOCK(pathStat.st_mode)) {
+            std::cout << std::string(socketPath) + " exists and is not a socket\n";
+            return 1;
+        }
+        int probeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        bool live = (probeFd >= 0) && (connect(probeFd, (sockaddr *) &addr, sizeof(addr)) == 0);
+        if (probeFd >= 0)
+            close(probeFd);
+        if (live) {
+            std::cout << "A server is already running at " + std::string(socketPath) + "\n";
+            return 1;
+        }
+        if (unlink(socketPath) < 0) {
+            std::cout << "Error removing old socket " + std::string(socketPath) + "\n";
+            return 1;
+        }
+    }
+
+    int serverFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((serverFd < 0) || (bind(serverFd, (sockaddr *) &addr, sizeof(addr)) < 0) || (listen(serverFd, 16) < 0)) {
+        std::cout << "Error creating socket " + std::string(socketPath) + "\n";
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); // client may disconnect before response is sent
+
+    std::map<std::string, Result> cache;
+    std::deque<std::string> cacheOrder; // oldest result first
+    while (true) {
+        int clientFd = accept(serverFd, NULL, NULL);
+        if (clientFd < 0)
+            continue;
+
+        // Split request into arguments line and grammar
+        std::string request = readAll(clientFd);
+        size_t lineEnd = request.find('\n');
+        if (lineEnd == std::string::npos) {
+            close(clientFd);
+            continue;
+        }
+        StrVec args;
+        std::istringstream argStream(request.substr(0, lineEnd));
+        std::string arg;
+        while (argStream >> arg)
+            args.push_back(arg);
+        if (args.empty())
+            args.push_back("");
+
+        // Look for result of identical request, otherwise run generator
+        if (cache.count(request) == 0) {
+            cache[request] = runRequest(args, request.substr(lineEnd + 1));
+            cacheOrder.push_back(request);
+            if (cacheOrder.size() > maxCached) {
+                cache.erase(cacheOrder.front());
+                cacheOrder.pop_front();
+            }
+        }
+
+        const Result& result = cache[request];
+        std::string header = std::to_string(result.status) + " " + std::to_string(result.report.length()) + " " + std::to_string(result.code.length()) + "\n";
+        writeAll(clientFd, header + result.report + result.code);
+        close(clientFd);
+    }
+}
+
+//--------//
+// Client //
+//--------//
+
+// Send grammar in inpFile to server, print report and write parser code to parser.cpp
+int runClient(std::string socketPath, const StrVec& args) {
+    std::string request = "";
+    for (const std::string& arg : args)
+        request += arg + " ";
+    request += "\n" + readFile(inpFile);
+    fclose(inpFile);
+
+    sockaddr_un addr;
+    if (!socketAddress(socketPath, addr))
+        return 1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((fd < 0) || (connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0)) {
+        std::cout << "Error connecting to server at " + socketPath + "\n";
+        return 1;
+    }
+    writeAll(fd, request);
+    shutdown(fd, SHUT_WR); // end of request
+    std::string response = readAll(fd);
+    close(fd);
+
+    // Split response into status, report and code
+    int status;
+    size_t reportLen, codeLen;
+    size_t headerEnd = response.find('\n');
+    if ((headerEnd == std::string::npos) || (sscanf(response.c_str(), "%d %zu %zu", &status, &reportLen, &codeLen) != 3) || (response.length() != headerEnd + 1 + reportLen + codeLen)) {
+        std::cout << "Invalid response from server\n";
+        return 1;
+    }
+    std::cout << response.substr(headerEnd + 1, reportLen);
+
+    // Parser code is only written if generation succeeded
+    if (status == 0)
+        writeIfChanged("parser.cpp", response.substr(headerEnd + 1 + reportLen, codeLen));
+    return status;
+}
+
+//------------//
+// Watch Mode //
+//------------//
+
+/* Generate parser, then regenerate it whenever the grammar file changes
+ * The directory is watched rather than the file, since editors often save by replacing
+ * the file; events for other files, and saves that leave the grammar unchanged, are
+ * ignored
+ * parser.cpp is only rewritten if the generated code differs */
+int runWatch(std::string grammarPath, const StrVec& args) {
+    size_t slash = grammarPath.rfind('/');
+    std::string dirPath = (slash == std::string::npos) ? "." : grammarPath.substr(0, slash + 1);
+    std::string fileName = (slash == std::string::npos) ? grammarPath : grammarPath.substr(slash + 1);
+
+    int watchFd = inotify_init();
+    if ((watchFd < 0) || (inotify_add_watch(watchFd, dirPath.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)) {
+        std::cout << "Error watching " + dirPath + "\n";
+        return 1;
+    }
+
+    std::string lastGrammar = "";
+    bool changed = true; // generate parser at start
+    while (true) {
+        FILE *grammarFile = fopen(grammarPath.c_str(), "r");
+        if (changed && (grammarFile != NULL)) {
+            std::string grammarStr = readFile(grammarFile);
+            if (grammarStr != lastGrammar) {
+                lastGrammar = grammarStr;
+                Result result = runRequest(args, grammarStr);
+                std::cout << result.report;
+                if (result.status == 0) {
+                    if (writeIfChanged("parser.cpp", result.code))
+                        std::cout << "parser.cpp updated\n";
+                    else
+                        std::cout << "parser.cpp unchanged\n";
+                }
+                std::cout << "Watching " + grammarPath + " for changes\n" << std::flush;
+            }
+        }
+        if (grammarFile != NULL)
+            fclose(grammarFile);
+
+        // Wait for events, and check whether any of them are for the grammar file
+        char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+        ssize_t n = read(watchFd, buffer, sizeof(buffer));
+        if (n <= 0)
+            return 1;
+        changed = false;
+        for (char *p = buffer; p < buffer + n; p += sizeof(inotify_event) + ((inotify_event *) p)->len) {
+            inotify_event *event = (inotify_event *) p;
+            if ((event->len > 0) && (fileName == event->name))
+                changed = true;
+        }
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+#ifndef SERVER_H
+#define SERVER_H
+
+int generate(const StrVec& args, std::ostream& parserFile); // run generator (main.cpp)
+int runServer(const char *socketPath);                         // serve generation requests
+int runClient(std::string socketPath, const StrVec& args);     // forward request to server
+int runWatch(std::string grammarPath, const StrVec& args);     // regenerate on grammar changes
+bool writeIfChanged(std::string path, const std::string& contents); // write file if different
+
+extern std::map<std::string, std::string> pFirstCache; // PFIRST sets kept between requests (main.cpp)
+extern FILE *pFirstCacheFile; // where a request writes the PFIRST sets it computed
+
+#endif
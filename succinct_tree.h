@@ -0,0 +1,312 @@
+#pragma once
+#ifndef SUCCINCT_TREE_H
+#define SUCCINCT_TREE_H
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* Reader for parse trees written by a generated parser with --succinct (the parser must be
+ * generated with --succinct too), and with --dag, DAGs with shared nodes written once
+ * File layout, with integers in the byte order of the machine that wrote it:
+ *   "BPT2", number of nodes (8 bytes), number of labels (4 bytes)
+ *   each label: kind (1 byte), length (4 bytes), text
+ *   bits per node label (1 byte)
+ *   parentheses, 64 to a word (8 bytes): for each node in preorder, 1 where it starts and
+ *   0 where it ends
+ *   label number of each node in preorder, packed into words
+ *   number of reference nodes (8 bytes)
+ *   each reference node: its number and the number of the node it refers to (8 bytes each)
+ * Files from before reference nodes start with "BPT1", and end after the labels; files with
+ * any other version are rejected
+ * Nodes are numbered in preorder, so the root is node 0
+ * Navigation uses the excess of each position (opens minus closes up to it), which is the
+ * depth of a node at its open; minimum excesses of 512-bit blocks are kept in a tree, so
+ * searches for the next or previous position with a given excess skip whole blocks */
+class SuccinctTree {
+    public:
+        enum NODE_KIND {NON_TERMINAL, CONJUNCT, TERMINAL, REFERENCE};
+        static constexpr size_t NONE = SIZE_MAX;
+
+    private:
+        static constexpr size_t BLOCK_BITS = 512;
+        static constexpr size_t BLOCK_WORDS = BLOCK_BITS / 64;
+
+        size_t nodeCount = 0;
+        std::vector<uint8_t> labelKinds;
+        std::vector<std::string> labelTexts;
+        unsigned labelBits = 1;
+        std::vector<uint64_t> parens;
+        std::vector<uint64_t> labels;
+        std::vector<uint64_t> references; // number of each reference node, and of the node it refers to
+
+        std::vector<uint64_t> blockRanks; // opens before each block
+        std::vector<long long> minTree;   // minimum excess of each block (leaves), and of each range of blocks
+        size_t leafCount = 1;             // number of leaves in minTree (power of two)
+
+        bool isOpen(size_t i) const {
+            return (parens[i / 64] >> (i % 64)) & 1;
+        }
+
+        // Excess at position i (excess before position 0 is 0)
+        long long excess(long long i) const {
+            return 2 * (long long)rank1(i + 1) - (i + 1);
+        }
+
+        // First block from block first onwards whose minimum excess is at most target
+        size_t firstBlockAtMost(size_t first, long long target) const {
+            size_t node = first + leafCount;
+            if (minTree[node] <= target)
+                return first;
+            while (true) { // go up until a right sibling has a small enough minimum
+                while (node % 2 == 1) {
+                    node /= 2;
+                    if (node == 0)
+                        return NONE;
+                }
+                node++;
+                if (minTree[node] <= target)
+                    break;
+            }
+            while (node < leafCount) // then down to its leftmost such leaf
+                node = (minTree[2 * node] <= target) ? 2 * node : 2 * node + 1;
+            return node - leafCount;
+        }
+
+        // Last block up to block last whose minimum excess is at most target
+        size_t lastBlockAtMost(size_t last, long long target) const {
+            size_t node = last + leafCount;
+            if (minTree[node] <= target)
+                return last;
+            while (true) {
+                while (node % 2 == 0) {
+                    node /= 2;
+                    if (node <= 1)
+                        return NONE;
+                }
+                node--;
+                if (minTree[node] <= target)
+                    break;
+            }
+            while (node < leafCount)
+                node = (minTree[2 * node + 1] <= target) ? 2 * node + 1 : 2 * node;
+            return node - leafCount;
+        }
+
+        // First position after i whose excess is at most target (NONE if there is none)
+        size_t forwardSearch(size_t i, long long target) const {
+            long long e = excess(i);
+            size_t blockEnd = (i / BLOCK_BITS + 1) * BLOCK_BITS;
+            for (size_t j = i + 1; (j < blockEnd) && (j < 2 * nodeCount); j++) {
+                e += isOpen(j) ? 1 : -1;
+                if (e <= target)
+                    return j;
+            }
+
+            size_t block = (blockEnd < 2 * nodeCount) ? firstBlockAtMost(i / BLOCK_BITS + 1, target) : NONE;
+            if (block == NONE)
+                return NONE;
+            size_t j = block * BLOCK_BITS;
+            e = excess((long long)j - 1);
+            while (true) {
+                e += isOpen(j) ? 1 : -1;
+                if (e <= target)
+                    return j;
+                j++;
+            }
+        }
+
+        /* Last position before i whose excess is at most target; position -1 (before the
+         * start, with excess 0) is returned as NONE */
+        size_t backwardSearch(size_t i, long long target) const {
+            long long e = excess(i);
+            size_t blockStart = (i / BLOCK_BITS) * BLOCK_BITS;
+            for (size_t j = i; j > blockStart; j--) {
+                e -= isOpen(j) ? 1 : -1; // excess at j - 1
+                if (e <= target)
+                    return j - 1;
+            }
+
+            size_t block = (blockStart > 0) ? lastBlockAtMost(i / BLOCK_BITS - 1, target) : NONE;
+            if (block == NONE)
+                return NONE;
+            size_t j = (block + 1) * BLOCK_BITS - 1;
+            e = excess(j);
+            while (e > target) {
+                e -= isOpen(j) ? 1 : -1;
+                j--;
+            }
+            return j;
+        }
+
+    public:
+        // Read tree from file; returns false if the file cannot be read or is not a tree
+        bool load(const std::string& fileName) {
+            FILE *file = fopen(fileName.c_str(), "rb");
+            if (file == NULL)
+                return false;
+
+            char magic[4];
+            uint64_t count;
+            uint32_t labelCount;
+            bool ok = (fread(magic, 1, 4, file) == 4) && ((std::string(magic, 4) == "BPT1") || (std::string(magic, 4) == "BPT2"));
+            bool hasReferences = ok && (magic[3] == '2');
+            ok = ok && (fread(&count, sizeof(count), 1, file) == 1) && (fread(&labelCount, sizeof(labelCount), 1, file) == 1);
+            for (uint32_t labelNo = 0; ok && (labelNo < labelCount); labelNo++) {
+                uint8_t kind;
+                uint32_t length;
+                ok = (fread(&kind, sizeof(kind), 1, file) == 1) && (fread(&length, sizeof(length), 1, file) == 1);
+                std::string text(ok ? length : 0, ' ');
+                ok = ok && (fread(text.data(), 1, length, file) == length);
+                labelKinds.push_back(kind);
+                labelTexts.push_back(text);
+            }
+            uint8_t bits;
+            ok = ok && (fread(&bits, sizeof(bits), 1, file) == 1) && (bits > 0) && (bits <= 32);
+            if (ok) {
+                nodeCount = count;
+                labelBits = bits;
+                parens.resize((2 * nodeCount + 63) / 64);
+                labels.resize((nodeCount * labelBits + 63) / 64);
+                ok = (fread(parens.data(), sizeof(uint64_t), parens.size(), file) == parens.size());
+                ok = ok && (fread(labels.data(), sizeof(uint64_t), labels.size(), file) == labels.size());
+                uint64_t referenceCount = 0;
+                ok = ok && (!hasReferences || (fread(&referenceCount, sizeof(referenceCount), 1, file) == 1));
+                references.resize(ok ? 2 * referenceCount : 0);
+                ok = ok && (fread(references.data(), sizeof(uint64_t), references.size(), file) == references.size());
+            }
+            fclose(file);
+            if (!ok)
+                return false;
+
+            // Count opens before each block, and find minimum excess of each block
+            size_t blockCount = (2 * nodeCount + BLOCK_BITS - 1) / BLOCK_BITS;
+            while (leafCount < blockCount)
+                leafCount *= 2;
+            minTree.assign(2 * leafCount, LLONG_MAX);
+            uint64_t opens = 0;
+            long long e = 0;
+            for (size_t block = 0; block < blockCount; block++) {
+                blockRanks.push_back(opens);
+                for (size_t i = block * BLOCK_BITS; (i < (block + 1) * BLOCK_BITS) && (i < 2 * nodeCount); i++) {
+                    e += isOpen(i) ? 1 : -1;
+                    minTree[leafCount + block] = std::min(minTree[leafCount + block], e);
+                }
+                for (size_t word = block * BLOCK_WORDS; (word < (block + 1) * BLOCK_WORDS) && (word < parens.size()); word++)
+                    opens += std::popcount(parens[word]);
+            }
+            blockRanks.push_back(opens);
+            for (size_t node = leafCount - 1; node > 0; node--)
+                minTree[node] = std::min(minTree[2 * node], minTree[2 * node + 1]);
+            return true;
+        }
+
+        size_t size() const {
+            return nodeCount;
+        }
+
+        // Number of opens before position i
+        size_t rank1(size_t i) const {
+            size_t block = i / BLOCK_BITS;
+            size_t rank = blockRanks[block];
+            for (size_t word = block * BLOCK_WORDS; word < i / 64; word++)
+                rank += std::popcount(parens[word]);
+            if (i % 64 > 0)
+                rank += std::popcount(parens[i / 64] & (((uint64_t)1 << (i % 64)) - 1));
+            return rank;
+        }
+
+        // Position of open number k, counting from 0 (the open of node k)
+        size_t select1(size_t k) const {
+            size_t low = 0, high = blockRanks.size() - 1; // last block with fewer than k + 1 opens before it
+            while (high - low > 1) {
+                size_t middle = (low + high) / 2;
+                if (blockRanks[middle] <= k)
+                    low = middle;
+                else
+                    high = middle;
+            }
+
+            size_t rank = blockRanks[low];
+            size_t word = low * BLOCK_WORDS;
+            while (rank + std::popcount(parens[word]) <= k)
+                rank += std::popcount(parens[word++]);
+            uint64_t bits = parens[word];
+            for (; rank < k; rank++)
+                bits &= bits - 1; // clear lowest open
+            return word * 64 + std::countr_zero(bits);
+        }
+
+        NODE_KIND kind(size_t node) const {
+            return (NODE_KIND)labelKinds[label(node)];
+        }
+
+        // Non-terminal name (with value, if it has a type), or terminal text
+        const std::string& text(size_t node) const {
+            return labelTexts[label(node)];
+        }
+
+        // Node that a reference node refers to (NONE if node is not a reference)
+        size_t target(size_t node) const {
+            size_t low = 0, high = references.size() / 2; // references are in order of node number
+            while (low < high) {
+                size_t middle = (low + high) / 2;
+                if (references[2 * middle] < node)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+            if ((low < references.size() / 2) && (references[2 * low] == node))
+                return references[2 * low + 1];
+            return NONE;
+        }
+
+        // Label number of node (nodes with the same kind and text have the same label)
+        size_t label(size_t node) const {
+            size_t bit = node * labelBits;
+            uint64_t value = labels[bit / 64] >> (bit % 64);
+            if (bit % 64 + labelBits > 64)
+                value |= labels[bit / 64 + 1] << (64 - bit % 64);
+            return value & ((labelBits == 64) ? ~(uint64_t)0 : ((uint64_t)1 << labelBits) - 1);
+        }
+
+        // Depth of node (the root has depth 1)
+        size_t depth(size_t node) const {
+            return excess(select1(node));
+        }
+
+        size_t parent(size_t node) const {
+            if (node == 0)
+                return NONE;
+            size_t open = select1(node);
+            size_t before = backwardSearch(open, excess(open) - 2);
+            return (before == NONE) ? 0 : rank1(before + 1);
+        }
+
+        size_t firstChild(size_t node) const {
+            size_t open = select1(node);
+            if ((open + 1 < 2 * nodeCount) && isOpen(open + 1))
+                return node + 1;
+            return NONE;
+        }
+
+        size_t nextSibling(size_t node) const {
+            size_t open = select1(node);
+            size_t close = forwardSearch(open, excess(open) - 1);
+            if ((close + 1 < 2 * nodeCount) && isOpen(close + 1))
+                return rank1(close + 1);
+            return NONE;
+        }
+
+        // Number of nodes in subtree of node, including itself
+        size_t subtreeSize(size_t node) const {
+            size_t open = select1(node);
+            return (forwardSearch(open, excess(open) - 1) - open + 1) / 2;
+        }
+};
+
+#endif